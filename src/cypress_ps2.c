@@ -24,11 +24,18 @@
 #include <linux/input/mt.h>
 #include <linux/sched.h>
 #include <linux/wait.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
 
 #include "cypress_ps2.h"
 
 #undef CYTP_DEBUG_VERBOSE  /* define this and DEBUG for more verbose dump */
 
+static bool cypress_simulated_mt = CYPRESS_SIMULATED_MT;
+module_param(cypress_simulated_mt, bool, 0644);
+MODULE_PARM_DESC(cypress_simulated_mt,
+	"Simulate contacts for Cypress trackpads beyond the two reported (applies at init).");
+
 static void cypress_set_packet_size(struct psmouse *psmouse, unsigned int n)
 {
 	struct cytp_data *cytp = psmouse->private;
@@ -169,17 +176,67 @@ static bool cypress_verify_cmd_state(struct psmouse *psmouse,
 	return false;
 }
 
-static int cypress_send_ext_cmd(struct psmouse *psmouse, unsigned char cmd,
-				unsigned char *param)
+/*
+ * Account one extension command in the per-command statistics. There are
+ * only a handful of different commands, so a short table searched
+ * linearly is enough; commands that do not fit are not recorded.
+ */
+static void cypress_account_cmd(struct cytp_data *cytp, unsigned char cmd,
+				int tries, int rc, ktime_t start)
 {
-	int tries = CYTP_PS2_CMD_TRIES;
-	int rc;
+	struct cytp_cmd_stats *stats;
+	unsigned int us;
+	int i;
+
+	for (i = 0; i < cytp->cmd_stats_cnt; i++)
+		if (cytp->cmd_stats[i].cmd == cmd)
+			break;
+
+	if (i == cytp->cmd_stats_cnt) {
+		if (i == CYTP_MAX_CMD_STATS)
+			return;
+		cytp->cmd_stats_cnt++;
+		cytp->cmd_stats[i].cmd = cmd;
+	}
+
+	stats = &cytp->cmd_stats[i];
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+
+	stats->count++;
+	stats->retries += tries - 1;
+	if (rc)
+		stats->failures++;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+}
+
+/*
+ * Send an extension command and read back its status. A failed attempt
+ * is retried after a short delay which doubles with each further try, so
+ * a single flaky response costs milliseconds rather than a fixed worst
+ * case. 'cytp' may be NULL while detecting, before per-device data
+ * exists, in which case no statistics are kept.
+ */
+static int __cypress_send_ext_cmd(struct psmouse *psmouse,
+				  struct cytp_data *cytp, unsigned char cmd,
+				  unsigned char *param)
+{
+	unsigned int delay = CYTP_PS2_CMD_BACKOFF;
+	ktime_t start = ktime_get();
+	int tries = 0;
+	int rc = -EIO;
 
 	psmouse_dbg(psmouse, "send extension cmd 0x%02x, [%d %d %d %d]\n",
 		 cmd, DECODE_CMD_AA(cmd), DECODE_CMD_BB(cmd),
 		 DECODE_CMD_CC(cmd), DECODE_CMD_DD(cmd));
 
-	do {
+	while (tries < CYTP_PS2_CMD_TRIES) {
+		if (tries++ > 0) {
+			msleep(delay);
+			delay = min(delay * 2, CYTP_PS2_CMD_DELAY);
+		}
+
 		cypress_ps2_ext_cmd(psmouse,
 				    PSMOUSE_CMD_SETRES, DECODE_CMD_DD(cmd));
 		cypress_ps2_ext_cmd(psmouse,
@@ -189,29 +246,48 @@ static int cypress_send_ext_cmd(struct psmouse *psmouse, unsigned char cmd,
 		cypress_ps2_ext_cmd(psmouse,
 				    PSMOUSE_CMD_SETRES, DECODE_CMD_AA(cmd));
 
-		rc = cypress_ps2_read_cmd_status(psmouse, cmd, param);
-		if (rc)
+		if (cypress_ps2_read_cmd_status(psmouse, cmd, param))
 			continue;
 
-		if (cypress_verify_cmd_state(psmouse, cmd, param))
-			return 0;
+		if (cypress_verify_cmd_state(psmouse, cmd, param)) {
+			rc = 0;
+			break;
+		}
+	}
 
-	} while (--tries > 0);
+	if (cytp)
+		cypress_account_cmd(cytp, cmd, tries, rc, start);
 
-	return -EIO;
+	return rc;
 }
 
-int cypress_detect(struct psmouse *psmouse, bool set_properties)
+static int cypress_send_ext_cmd(struct psmouse *psmouse, unsigned char cmd,
+				unsigned char *param)
 {
-	unsigned char param[3];
+	return __cypress_send_ext_cmd(psmouse, psmouse->private, cmd, param);
+}
 
-	if (cypress_send_ext_cmd(psmouse, CYTP_CMD_READ_CYPRESS_ID, param))
+static int cypress_read_id(struct psmouse *psmouse, struct cytp_data *cytp,
+			   unsigned char *param)
+{
+	if (__cypress_send_ext_cmd(psmouse, cytp,
+				   CYTP_CMD_READ_CYPRESS_ID, param))
 		return -ENODEV;
 
 	/* Check for Cypress Trackpad signature bytes: 0x33 0xCC */
 	if (param[0] != 0x33 || param[1] != 0xCC)
 		return -ENODEV;
 
+	return 0;
+}
+
+int cypress_detect(struct psmouse *psmouse, bool set_properties)
+{
+	unsigned char param[3];
+
+	if (cypress_read_id(psmouse, NULL, param))
+		return -ENODEV;
+
 	if (set_properties) {
 		psmouse->vendor = "Cypress";
 		psmouse->name = "Trackpad";
@@ -225,11 +301,7 @@ static int cypress_read_fw_version(struct psmouse *psmouse)
 	struct cytp_data *cytp = psmouse->private;
 	unsigned char param[3];
 
-	if (cypress_send_ext_cmd(psmouse, CYTP_CMD_READ_CYPRESS_ID, param))
-		return -ENODEV;
-
-	/* Check for Cypress Trackpad signature bytes: 0x33 0xCC */
-	if (param[0] != 0x33 || param[1] != 0xCC)
+	if (cypress_read_id(psmouse, cytp, param))
 		return -ENODEV;
 
 	cytp->fw_version = param[2] & FW_VERSION_MASX;
@@ -385,14 +457,14 @@ static int cypress_set_input_params(struct input_dev *input,
 	input_set_abs_params(input, ABS_MT_POSITION_Y, 0, cytp->tp_max_abs_y, 0, 0);
 	input_set_abs_params(input, ABS_MT_PRESSURE, 0, 255, 0, 0);
 
-	ret = input_mt_init_slots(input, CYTP_MAX_MT_SLOTS,
+	ret = input_mt_init_slots(input, cytp->simulated_mt ?
+					CYTP_MAX_MT_SLOTS : CYTP_SEMI_MT_SLOTS,
 			INPUT_MT_DROP_UNUSED|INPUT_MT_TRACK);
 	if (ret < 0)
 		return ret;
 
-#if ( CYPRESS_SIMULATED_MT != 1 )
-	__set_bit(INPUT_PROP_SEMI_MT, input->propbit);
-#endif
+	if (!cytp->simulated_mt)
+		__set_bit(INPUT_PROP_SEMI_MT, input->propbit);
 
 	input_abs_set_res(input, ABS_X, cytp->tp_res_x);
 	input_abs_set_res(input, ABS_Y, cytp->tp_res_y);
@@ -453,53 +525,57 @@ static int cypress_parse_packet(struct psmouse *psmouse,
 	unsigned char *packet = psmouse->packet;
 	unsigned char header_byte = packet[0];
 
-	memset(report_data, 0, sizeof(struct cytp_report_data));
-
-	report_data->contact_cnt = cypress_get_finger_count(header_byte);
+	/*
+	 * Every field consumers look at is assigned below, contacts[] only
+	 * up to pos_cnt, so the report does not need to be cleared first.
+	 */
+	report_data->contact_cnt = cytp->frame_contacts;
+	report_data->pos_cnt = 0;
 	report_data->tap = (header_byte & ABS_MULTIFINGER_TAP) ? 1 : 0;
 
-	if (report_data->contact_cnt == 1) {
-		report_data->contacts[0].x =
-			((packet[1] & 0x70) << 4) | packet[2];
-		report_data->contacts[0].y =
-			((packet[1] & 0x07) << 8) | packet[3];
-		if (cytp->mode & CYTP_BIT_ABS_PRESSURE)
-			report_data->contacts[0].z = packet[4];
-
-	} else if (report_data->contact_cnt >= 2) {
+	/*
+	 * Only two finger packets carry a second position; with three or
+	 * more fingers the trackpad sends a short packet with the first
+	 * contact only.
+	 */
+	if (report_data->contact_cnt >= 1) {
 		report_data->contacts[0].x =
 			((packet[1] & 0x70) << 4) | packet[2];
 		report_data->contacts[0].y =
 			((packet[1] & 0x07) << 8) | packet[3];
-		if (cytp->mode & CYTP_BIT_ABS_PRESSURE)
-			report_data->contacts[0].z = packet[4];
+		report_data->contacts[0].z =
+			(cytp->mode & CYTP_BIT_ABS_PRESSURE) ? packet[4] : 0;
+		report_data->pos_cnt = 1;
+	}
 
+	if (report_data->contact_cnt == 2) {
 		report_data->contacts[1].x =
 			((packet[5] & 0xf0) << 4) | packet[6];
 		report_data->contacts[1].y =
 			((packet[5] & 0x0f) << 8) | packet[7];
-		if (cytp->mode & CYTP_BIT_ABS_PRESSURE)
-			report_data->contacts[1].z = report_data->contacts[0].z;
-#if ( CYPRESS_SIMULATED_MT == 1 )
-		/* simulate contact positions for >2 fingers */
-		if ( report_data->contact_cnt >= 3 ) {
-			int i;
-			for ( i=1; i<report_data->contact_cnt; i++ ) {
-			    report_data->contacts[i].x =
-					    report_data->contacts[0].x
-					    + 100*(i)*((i%2)?-1:1);
-			    report_data->contacts[i].y =
-					    report_data->contacts[0].y;
-			    if (cytp->mode & CYTP_BIT_ABS_PRESSURE)
-				    report_data->contacts[i].z =
-					    report_data->contacts[0].z;
-			}
+		report_data->contacts[1].z = report_data->contacts[0].z;
+		report_data->pos_cnt = 2;
+	}
+
+	/* simulate contact positions for >2 fingers */
+	if (cytp->simulated_mt && report_data->contact_cnt >= 3) {
+		int i;
+
+		for (i = 1; i < report_data->contact_cnt; i++) {
+			report_data->contacts[i].x =
+				report_data->contacts[0].x
+				+ 100 * i * ((i % 2) ? -1 : 1);
+			report_data->contacts[i].y =
+				report_data->contacts[0].y;
+			report_data->contacts[i].z =
+				report_data->contacts[0].z;
 		}
-#endif
+		report_data->pos_cnt = report_data->contact_cnt;
 	}
 
 	report_data->left = (header_byte & BTN_LEFT_BIT) ? 1 : 0;
 	report_data->right = (header_byte & BTN_RIGHT_BIT) ? 1 : 0;
+	report_data->middle = 0;
 
 	/*
 	 * This is only true if one of the mouse buttons were tapped.  Make
@@ -513,12 +589,10 @@ static int cypress_parse_packet(struct psmouse *psmouse,
 #ifdef CYTP_DEBUG_VERBOSE
 	{
 		int i;
-		int n = report_data->contact_cnt;
+		int n = report_data->pos_cnt;
 		psmouse_dbg(psmouse, "Dump parsed report data as below:\n");
 		psmouse_dbg(psmouse, "contact_cnt = %d\n",
 			report_data->contact_cnt);
-		if (n > CYTP_MAX_MT_SLOTS)
-		    n = CYTP_MAX_MT_SLOTS;
 		for (i = 0; i < n; i++)
 			psmouse_dbg(psmouse, "contacts[%d] = {%d, %d, %d}\n", i,
 					report_data->contacts[i].x,
@@ -546,9 +620,7 @@ static void cypress_process_packet(struct psmouse *psmouse, bool zero_pkt)
 
 	cypress_parse_packet(psmouse, cytp, &report_data);
 
-	n = report_data.contact_cnt;
-	if (n > CYTP_MAX_MT_SLOTS)
-		n = CYTP_MAX_MT_SLOTS;
+	n = report_data.pos_cnt;
 
 	for (i = 0; i < n; i++) {
 		contact = &report_data.contacts[i];
@@ -578,28 +650,27 @@ static void cypress_process_packet(struct psmouse *psmouse, bool zero_pkt)
 	input_sync(input);
 }
 
-static psmouse_ret_t cypress_validate_byte(struct psmouse *psmouse)
+/*
+ * The header byte tells how long the packet is going to be: one finger
+ * packets carry a single position, two finger packets a second one, and
+ * a header with no finger or button bits is a complete packet on its own
+ * announcing that all fingers left the pad. The length is decided here,
+ * once per packet; the remaining bytes are just collected.
+ */
+static psmouse_ret_t cypress_frame_header(struct psmouse *psmouse)
 {
-	int contact_cnt;
-	int index = psmouse->pktcnt - 1;
-	unsigned char *packet = psmouse->packet;
 	struct cytp_data *cytp = psmouse->private;
+	unsigned char header = psmouse->packet[0];
 
-	if (index < 0 || index > cytp->pkt_size)
-		return PSMOUSE_BAD_DATA;
-
-	if (index == 0 && (packet[0] & 0xfc) == 0) {
+	if ((header & 0xfc) == 0) {
 		/* call packet process for reporting finger leave. */
+		cytp->frame_contacts = 0;
 		cypress_process_packet(psmouse, 1);
+		cytp->frame_count++;
 		return PSMOUSE_FULL_PACKET;
 	}
 
-	/*
-	 * Perform validation (and adjust packet size) based only on the
-	 * first byte; allow all further bytes through.
-	 */
-	if (index != 0)
-		return PSMOUSE_GOOD_DATA;
+	cytp->frame_contacts = cypress_get_finger_count(header);
 
 	/*
 	 * If absolute/relative mode bit has not been set yet, just pass
@@ -608,14 +679,14 @@ static psmouse_ret_t cypress_validate_byte(struct psmouse *psmouse)
 	if ((cytp->mode & CYTP_BIT_ABS_REL_MASK) == 0)
 		return PSMOUSE_GOOD_DATA;
 
-	if ((packet[0] & 0x08) == 0x08)
+	if (header & 0x08) {
+		cytp->frame_errors++;
 		return PSMOUSE_BAD_DATA;
+	}
 
-	contact_cnt = cypress_get_finger_count(packet[0]);
-	if (cytp->mode & CYTP_BIT_ABS_NO_PRESSURE)
-		cypress_set_packet_size(psmouse, contact_cnt == 2 ? 7 : 4);
-	else
-		cypress_set_packet_size(psmouse, contact_cnt == 2 ? 8 : 5);
+	cypress_set_packet_size(psmouse,
+				(cytp->mode & CYTP_BIT_ABS_NO_PRESSURE ? 4 : 5) +
+				(cytp->frame_contacts == 2 ? 3 : 0));
 
 	return PSMOUSE_GOOD_DATA;
 }
@@ -624,12 +695,15 @@ static psmouse_ret_t cypress_protocol_handler(struct psmouse *psmouse)
 {
 	struct cytp_data *cytp = psmouse->private;
 
-	if (psmouse->pktcnt >= cytp->pkt_size) {
-		cypress_process_packet(psmouse, 0);
-		return PSMOUSE_FULL_PACKET;
-	}
+	if (psmouse->pktcnt == 1)
+		return cypress_frame_header(psmouse);
+
+	if (psmouse->pktcnt < cytp->pkt_size)
+		return PSMOUSE_GOOD_DATA;
 
-	return cypress_validate_byte(psmouse);
+	cypress_process_packet(psmouse, 0);
+	cytp->frame_count++;
+	return PSMOUSE_FULL_PACKET;
 }
 
 static void cypress_set_rate(struct psmouse *psmouse, unsigned int rate)
@@ -648,8 +722,68 @@ static void cypress_set_rate(struct psmouse *psmouse, unsigned int rate)
 		    PSMOUSE_CMD_SETRATE);
 }
 
+static ssize_t cypress_show_frame_count(struct psmouse *psmouse,
+					void *data, char *buf)
+{
+	struct cytp_data *cytp = psmouse->private;
+
+	return sprintf(buf, "%lu\n", cytp->frame_count);
+}
+
+PSMOUSE_DEFINE_RO_ATTR(frame_count, S_IRUGO, NULL, cypress_show_frame_count);
+
+static ssize_t cypress_show_frame_errors(struct psmouse *psmouse,
+					 void *data, char *buf)
+{
+	struct cytp_data *cytp = psmouse->private;
+
+	return sprintf(buf, "%lu\n", cytp->frame_errors);
+}
+
+PSMOUSE_DEFINE_RO_ATTR(frame_errors, S_IRUGO, NULL, cypress_show_frame_errors);
+
+/*
+ * One line per extension command sent so far:
+ * command, times sent, retries, failures, average and worst latency (us)
+ */
+static ssize_t cypress_show_cmd_stats(struct psmouse *psmouse,
+				      void *data, char *buf)
+{
+	struct cytp_data *cytp = psmouse->private;
+	struct cytp_cmd_stats *stats;
+	int i, len = 0;
+
+	for (i = 0; i < cytp->cmd_stats_cnt; i++) {
+		stats = &cytp->cmd_stats[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "0x%02x %u %u %u %llu %u\n",
+				 stats->cmd, stats->count, stats->retries,
+				 stats->failures,
+				 (unsigned long long)div_u64(stats->total_us,
+							       stats->count),
+				 stats->max_us);
+	}
+
+	return len;
+}
+
+PSMOUSE_DEFINE_RO_ATTR(cmd_stats, S_IRUGO, NULL, cypress_show_cmd_stats);
+
+static struct attribute *cypress_attrs[] = {
+	&psmouse_attr_frame_count.dattr.attr,
+	&psmouse_attr_frame_errors.dattr.attr,
+	&psmouse_attr_cmd_stats.dattr.attr,
+	NULL
+};
+
+static struct attribute_group cypress_attr_group = {
+	.attrs = cypress_attrs,
+};
+
 static void cypress_disconnect(struct psmouse *psmouse)
 {
+	sysfs_remove_group(&psmouse->ps2dev.serio->dev.kobj,
+			   &cypress_attr_group);
 	cypress_reset(psmouse);
 	kfree(psmouse->private);
 	psmouse->private = NULL;
@@ -657,12 +791,13 @@ static void cypress_disconnect(struct psmouse *psmouse)
 
 static int cypress_reconnect(struct psmouse *psmouse)
 {
+	unsigned char param[3];
 	int tries = CYTP_PS2_CMD_TRIES;
 	int rc;
 
 	do {
 		cypress_reset(psmouse);
-		rc = cypress_detect(psmouse, false);
+		rc = cypress_read_id(psmouse, psmouse->private, param);
 	} while (rc && (--tries > 0));
 
 	if (rc) {
@@ -689,6 +824,8 @@ int cypress_init(struct psmouse *psmouse)
 	psmouse->private = cytp;
 	psmouse->pktsize = 8;
 
+	cytp->simulated_mt = cypress_simulated_mt;
+
 	cypress_reset(psmouse);
 
 	if (cypress_query_hardware(psmouse)) {
@@ -706,6 +843,12 @@ int cypress_init(struct psmouse *psmouse)
 		goto err_exit;
 	}
 
+	if (sysfs_create_group(&psmouse->ps2dev.serio->dev.kobj,
+			       &cypress_attr_group)) {
+		psmouse_err(psmouse, "init: Unable to create sysfs attributes.\n");
+		goto err_exit;
+	}
+
 	psmouse->model = 1;
 	psmouse->protocol_handler = cypress_protocol_handler;
 	psmouse->set_rate = cypress_set_rate;
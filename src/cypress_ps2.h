@@ -62,9 +62,16 @@
 #define FW_VER_HIGH_MASK 0x70
 #define FW_VER_LOW_MASK  0x0f
 
-/* Times to retry a ps2_command and millisecond delay between tries. */
-#define CYTP_PS2_CMD_TRIES 3
-#define CYTP_PS2_CMD_DELAY 500
+/*
+ * Times to retry a ps2_command and millisecond delay between tries: the
+ * delay starts at CYTP_PS2_CMD_BACKOFF and doubles up to CYTP_PS2_CMD_DELAY.
+ */
+#define CYTP_PS2_CMD_TRIES   3
+#define CYTP_PS2_CMD_BACKOFF 10U
+#define CYTP_PS2_CMD_DELAY   500U
+
+/* Number of different extension commands statistics are kept for. */
+#define CYTP_MAX_CMD_STATS 8
 
 /* time out for PS/2 command only in milliseconds. */
 #define CYTP_CMD_TIMEOUT  200
@@ -131,17 +138,15 @@
 #define RESP_SMBUS_BIT      0x80
 
 /*
- * CYPRESS_SIMULATED_MT
+ * CYPRESS_SIMULATED_MT, default for the cypress_simulated_mt parameter
  *   set to 1 for simulated multitouch (up to 5 contact points)
- *   set to 0 for SEMI_MT (only 2 corner points, and count of fingers)
+ *   set to 0 for SEMI_MT (only the contacts the trackpad reports, and
+ *   count of fingers)
  */
-#define CYPRESS_SIMULATED_MT 1
+#define CYPRESS_SIMULATED_MT 0
 
-#if ( CYPRESS_SIMULATED_MT == 1 )
-# define CYTP_MAX_MT_SLOTS 5
-#else
-# define CYTP_MAX_MT_SLOTS 2
-#endif
+#define CYTP_MAX_MT_SLOTS  5  /* simulated multitouch */
+#define CYTP_SEMI_MT_SLOTS 2  /* contacts reported by the trackpad */
 
 struct cytp_contact {
 	int x;
@@ -152,6 +157,7 @@ struct cytp_contact {
 /* The structure of Cypress Trackpad event data. */
 struct cytp_report_data {
 	int contact_cnt;
+	int pos_cnt;  /* number of valid entries in contacts[]. */
 	struct cytp_contact contacts[CYTP_MAX_MT_SLOTS];
 	unsigned int left:1;
 	unsigned int right:1;
@@ -159,6 +165,16 @@ struct cytp_report_data {
 	unsigned int tap:1;  /* multi-finger tap detected. */
 };
 
+/* Statistics of one extension command. */
+struct cytp_cmd_stats {
+	unsigned char cmd;
+	unsigned int count;  /* times the command was sent. */
+	unsigned int retries;
+	unsigned int failures;  /* commands that ran out of tries. */
+	u64 total_us;
+	unsigned int max_us;
+};
+
 /* The structure of Cypress Trackpad device private data. */
 struct cytp_data {
 	int fw_version;
@@ -166,6 +182,10 @@ struct cytp_data {
 	int pkt_size;
 	int mode;
 
+	int frame_contacts;  /* finger count decoded from the header byte. */
+	unsigned long frame_count;  /* complete packets. */
+	unsigned long frame_errors;  /* packets dropped on a bad header. */
+
 	int tp_min_pressure;
 	int tp_max_pressure;
 	int tp_width;  /* X direction physical size in mm. */
@@ -177,6 +197,11 @@ struct cytp_data {
 	int tp_res_y;  /* Y resolution in units/mm. */
 
 	int tp_metrics_supported;
+
+	bool simulated_mt;
+
+	struct cytp_cmd_stats cmd_stats[CYTP_MAX_CMD_STATS];
+	int cmd_stats_cnt;
 };
 
 
@@ -10,14 +10,18 @@
  * Trademarks are the property of their respective owners.
  */
 
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dmi.h>
 #include <linux/slab.h>
 #include <linux/module.h>
 #include <linux/input.h>
 #include <linux/input/mt.h>
+#include <linux/seq_file.h>
 #include <linux/serio.h>
 #include <linux/libps2.h>
+#include <linux/timer.h>
 #include "psmouse.h"
 #include "elantech.h"
 
@@ -88,22 +92,27 @@ static int elantech_ps2_command(struct psmouse *psmouse,
 	return rc;
 }
 
+static bool elantech_reg_implemented(unsigned char reg)
+{
+	if (reg < ETP_REG_FIRST || reg > ETP_REG_LAST)
+		return false;
+
+	if (reg > 0x11 && reg < 0x20)
+		return false;
+
+	return true;
+}
+
 /*
  * Send an Elantech style special command to read a value from a register
  */
-static int elantech_read_reg(struct psmouse *psmouse, unsigned char reg,
+static int __elantech_read_reg(struct psmouse *psmouse, unsigned char reg,
 				unsigned char *val)
 {
 	struct elantech_data *etd = psmouse->private;
 	unsigned char param[3];
 	int rc = 0;
 
-	if (reg < 0x07 || reg > 0x26)
-		return -1;
-
-	if (reg > 0x11 && reg < 0x20)
-		return -1;
-
 	switch (etd->hw_version) {
 	case 1:
 		if (psmouse_sliced_command(psmouse, ETP_REGISTER_READ) ||
@@ -147,18 +156,12 @@ static int elantech_read_reg(struct psmouse *psmouse, unsigned char reg,
 /*
  * Send an Elantech style special command to write a register with a value
  */
-static int elantech_write_reg(struct psmouse *psmouse, unsigned char reg,
+static int __elantech_write_reg(struct psmouse *psmouse, unsigned char reg,
 				unsigned char val)
 {
 	struct elantech_data *etd = psmouse->private;
 	int rc = 0;
 
-	if (reg < 0x07 || reg > 0x26)
-		return -1;
-
-	if (reg > 0x11 && reg < 0x20)
-		return -1;
-
 	switch (etd->hw_version) {
 	case 1:
 		if (psmouse_sliced_command(psmouse, ETP_REGISTER_WRITE) ||
@@ -217,16 +220,125 @@ static int elantech_write_reg(struct psmouse *psmouse, unsigned char reg,
 }
 
 /*
- * Dump a complete mouse movement packet to the syslog
+ * Every register access costs several PS/2 commands, so we keep a cache
+ * of the register file. Reads are served from the cache once a register
+ * is known, and writes are queued and only sent to the hardware when the
+ * value actually changes.
+ */
+static int elantech_read_reg(struct psmouse *psmouse, unsigned char reg,
+				unsigned char *val)
+{
+	struct elantech_data *etd = psmouse->private;
+	unsigned int i = reg - ETP_REG_FIRST;
+
+	if (!elantech_reg_implemented(reg))
+		return -1;
+
+	if (!(etd->regs_valid & ETP_REG_BIT(reg))) {
+		if (__elantech_read_reg(psmouse, reg, &etd->regs[i]))
+			return -1;
+		etd->regs_valid |= ETP_REG_BIT(reg);
+	}
+
+	*val = etd->regs[i];
+	return 0;
+}
+
+/*
+ * Queue a register write. The cached value and state of a register are
+ * saved when it first becomes dirty, so a write the touchpad rejects can
+ * be undone without losing a value it accepted earlier.
+ */
+static void elantech_queue_reg(struct elantech_data *etd, unsigned char reg,
+				unsigned char val)
+{
+	unsigned int i = reg - ETP_REG_FIRST;
+	u32 bit = ETP_REG_BIT(reg);
+
+	if ((etd->regs_valid & bit) && etd->regs[i] == val)
+		return;
+
+	if (!(etd->regs_dirty & bit)) {
+		etd->regs_prev[i] = etd->regs[i];
+		etd->regs_prev_valid = (etd->regs_prev_valid & ~bit) |
+				       (etd->regs_valid & bit);
+		etd->regs_prev_written = (etd->regs_prev_written & ~bit) |
+					 (etd->regs_written & bit);
+		etd->regs_dirty |= bit;
+	}
+
+	etd->regs[i] = val;
+}
+
+/*
+ * Drop all queued writes, restoring the cache entries they replaced
+ */
+static void elantech_revert_regs(struct elantech_data *etd)
+{
+	unsigned int i;
+	u32 bit;
+
+	while (etd->regs_dirty) {
+		i = __ffs(etd->regs_dirty);
+		bit = 1U << i;
+
+		etd->regs[i] = etd->regs_prev[i];
+		etd->regs_valid = (etd->regs_valid & ~bit) |
+				  (etd->regs_prev_valid & bit);
+		etd->regs_written = (etd->regs_written & ~bit) |
+				    (etd->regs_prev_written & bit);
+		etd->regs_dirty &= ~bit;
+	}
+}
+
+/*
+ * Write all queued registers to the hardware in ascending order. On the
+ * first failure the rejected write and any not yet sent are dropped, so
+ * they are neither retried later nor replayed on reconnect.
+ */
+static int elantech_flush_regs(struct psmouse *psmouse)
+{
+	struct elantech_data *etd = psmouse->private;
+	unsigned char reg;
+	u32 bit;
+
+	while (etd->regs_dirty) {
+		reg = ETP_REG_FIRST + __ffs(etd->regs_dirty);
+		bit = ETP_REG_BIT(reg);
+
+		if (__elantech_write_reg(psmouse, reg,
+					 etd->regs[reg - ETP_REG_FIRST])) {
+			elantech_revert_regs(etd);
+			return -1;
+		}
+
+		etd->regs_dirty &= ~bit;
+		etd->regs_valid |= bit;
+		etd->regs_written |= bit;
+	}
+
+	return 0;
+}
+
+static int elantech_write_reg(struct psmouse *psmouse, unsigned char reg,
+				unsigned char val)
+{
+	if (!elantech_reg_implemented(reg))
+		return -1;
+
+	elantech_queue_reg(psmouse->private, reg, val);
+	return elantech_flush_regs(psmouse);
+}
+
+/*
+ * Record a packet in the trace ring, if tracing is enabled
  */
-static void elantech_packet_dump(struct psmouse *psmouse)
+static void elantech_packet_record(struct psmouse *psmouse, int packet_type)
 {
-	int	i;
+	struct elantech_data *etd = psmouse->private;
 
-	psmouse_printk(KERN_DEBUG, psmouse, "PS/2 packet [");
-	for (i = 0; i < psmouse->pktsize; i++)
-		printk("%s0x%02x ", i ? ", " : " ", psmouse->packet[i]);
-	printk("]\n");
+	if (psmouse_trace_begin(&etd->trace, packet_type))
+		psmouse_trace_commit(&etd->trace);
 }
 
 /*
@@ -506,13 +618,88 @@ static void elantech_input_sync_v4(struct psmouse *psmouse)
 	input_sync(dev);
 }
 
+/*
+ * v4 hardware spreads one frame over several packets: a head or motion
+ * packet updates one or two fingers only. Events of each packet are
+ * handed to the input core right away, but input_sync() is held back
+ * until the frame is complete, which is when every finger announced by
+ * the last status packet has been updated, when a finger is reported a
+ * second time (the touchpad started the next frame), at a motion packet
+ * carrying a single finger (the only one that moved), or at the next
+ * status packet. A frame still open ETP_FRAME_TIMEOUT ms after its last
+ * packet is flushed by frame_timer, so resting fingers never leave their
+ * last update unsynced; a packet arriving after such a gap closes the
+ * frame itself should it beat the timer.
+ */
+static void elantech_frame_flush_v4(struct psmouse *psmouse)
+{
+	struct elantech_data *etd = psmouse->private;
+	u64 ns;
+
+	if (!etd->frame_open)
+		return;
+
+	elantech_input_sync_v4(psmouse);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), etd->frame_start));
+	etd->frame_last_ns = ns;
+	if (ns > etd->frame_max_ns)
+		etd->frame_max_ns = ns;
+	etd->frame_count++;
+
+	etd->frame_slots = 0;
+	etd->frame_open = false;
+	del_timer(&etd->frame_timer);
+}
+
+static void elantech_frame_timeout_v4(unsigned long data)
+{
+	struct psmouse *psmouse = (struct psmouse *)data;
+
+	serio_pause_rx(psmouse->ps2dev.serio);
+	elantech_frame_flush_v4(psmouse);
+	serio_continue_rx(psmouse->ps2dev.serio);
+}
+
+static void elantech_frame_add_v4(struct psmouse *psmouse, unsigned int slots)
+{
+	struct elantech_data *etd = psmouse->private;
+
+	if ((etd->frame_slots & slots) ||
+	    ktime_to_ms(ktime_sub(psmouse->packet_time,
+				  psmouse->prev_packet_time)) > ETP_FRAME_TIMEOUT)
+		elantech_frame_flush_v4(psmouse);
+
+	if (!etd->frame_open) {
+		etd->frame_start = psmouse->packet_time;
+		etd->frame_open = true;
+	}
+
+	etd->frame_slots |= slots;
+	etd->frame_packets++;
+}
+
+static void elantech_frame_check_v4(struct psmouse *psmouse)
+{
+	struct elantech_data *etd = psmouse->private;
+
+	if ((etd->frame_slots & etd->fingers_v4) == etd->fingers_v4)
+		elantech_frame_flush_v4(psmouse);
+	else
+		mod_timer(&etd->frame_timer,
+			  jiffies + msecs_to_jiffies(ETP_FRAME_TIMEOUT));
+}
+
 static void process_packet_status_v4(struct psmouse *psmouse)
 {
 	struct input_dev *dev = psmouse->dev;
+	struct elantech_data *etd = psmouse->private;
 	unsigned char *packet = psmouse->packet;
 	unsigned fingers;
 	int i;
 
+	elantech_frame_add_v4(psmouse, 0);
+
 	/* notify finger state change */
 	fingers = packet[1] & 0x1f;
 	for (i = 0; i < ETP_MAX_FINGERS; i++) {
@@ -522,7 +709,8 @@ static void process_packet_status_v4(struct psmouse *psmouse)
 		}
 	}
 
-	elantech_input_sync_v4(psmouse);
+	etd->fingers_v4 = fingers;
+	elantech_frame_flush_v4(psmouse);
 }
 
 static void process_packet_head_v4(struct psmouse *psmouse)
@@ -536,6 +724,8 @@ static void process_packet_head_v4(struct psmouse *psmouse)
 	if (id < 0)
 		return;
 
+	elantech_frame_add_v4(psmouse, 1 << id);
+
 	etd->mt[id].x = ((packet[1] & 0x0f) << 8) | packet[2];
 	etd->mt[id].y = etd->y_max - (((packet[4] & 0x0f) << 8) | packet[5]);
 	pres = (packet[1] & 0xf0) | ((packet[4] & 0xf0) >> 4);
@@ -551,7 +741,7 @@ static void process_packet_head_v4(struct psmouse *psmouse)
 	/* report this for backwards compatibility */
 	input_report_abs(dev, ABS_TOOL_WIDTH, traces);
 
-	elantech_input_sync_v4(psmouse);
+	elantech_frame_check_v4(psmouse);
 }
 
 static void process_packet_motion_v4(struct psmouse *psmouse)
@@ -567,6 +757,8 @@ static void process_packet_motion_v4(struct psmouse *psmouse)
 		return;
 
 	sid = ((packet[3] & 0xe0) >> 5) - 1;
+	elantech_frame_add_v4(psmouse, (1 << id) | (sid >= 0 ? 1 << sid : 0));
+
 	weight = (packet[0] & 0x10) ? ETP_WEIGHT_VALUE : 1;
 	/*
 	 * Motion packets give us the delta of x, y values of specific fingers,
@@ -592,7 +784,11 @@ static void process_packet_motion_v4(struct psmouse *psmouse)
 		input_report_abs(dev, ABS_MT_POSITION_Y, etd->mt[sid].y);
 	}
 
-	elantech_input_sync_v4(psmouse);
+	/* a single finger in a motion packet is the only one that moved */
+	if (sid < 0)
+		elantech_frame_flush_v4(psmouse);
+	else
+		elantech_frame_check_v4(psmouse);
 }
 
 static void elantech_report_absolute_v4(struct psmouse *psmouse,
@@ -618,47 +814,63 @@ static void elantech_report_absolute_v4(struct psmouse *psmouse,
 	}
 }
 
-static int elantech_packet_check_v1(struct psmouse *psmouse)
+/*
+ * Debounce packets are sent while the hardware is in debounce status and
+ * are silently ignored. On v3 the debounce packet has the same signature
+ * in byte 0 and byte 3 as PACKET_V3_HEAD.
+ */
+static const unsigned char elantech_debounce_v2[] = {
+	0x84, 0xff, 0xff, 0x02, 0xff, 0xff
+};
+static const unsigned char elantech_debounce_v3[] = {
+	0xc4, 0xff, 0xff, 0x02, 0xff, 0xff
+};
+
+/*
+ * Odd parity bit for every byte value, as used by v1 hardware. The table
+ * is the same for every touchpad so it is built at compile time.
+ */
+#define P2(n)	n, n ^ 1, n ^ 1, n
+#define P4(n)	P2(n), P2(n ^ 1), P2(n ^ 1), P2(n)
+#define P6(n)	P4(n), P4(n ^ 1), P4(n ^ 1), P4(n)
+static const unsigned char elantech_parity[256] = {
+	P6(1), P6(0), P6(0), P6(1)
+};
+#undef P2
+#undef P4
+#undef P6
+
+static bool elantech_check_byte_v1(struct elantech_data *etd,
+				   const unsigned char *packet, int idx)
 {
-	struct elantech_data *etd = psmouse->private;
-	unsigned char *packet = psmouse->packet;
-	unsigned char p1, p2, p3;
+	unsigned char p;
 
 	/* Parity bits are placed differently */
-	if (etd->fw_version < 0x020000) {
+	switch (idx) {
+	case 1:
 		/* byte 0:  D   U  p1  p2   1  p3   R   L */
-		p1 = (packet[0] & 0x20) >> 5;
-		p2 = (packet[0] & 0x10) >> 4;
-	} else {
 		/* byte 0: n1  n0  p2  p1   1  p3   R   L */
-		p1 = (packet[0] & 0x10) >> 4;
-		p2 = (packet[0] & 0x20) >> 5;
-	}
+		p = etd->fw_version < 0x020000 ? packet[0] >> 5 : packet[0] >> 4;
+		break;
 
-	p3 = (packet[0] & 0x04) >> 2;
+	case 2:
+		p = etd->fw_version < 0x020000 ? packet[0] >> 4 : packet[0] >> 5;
+		break;
 
-	return etd->parity[packet[1]] == p1 &&
-	       etd->parity[packet[2]] == p2 &&
-	       etd->parity[packet[3]] == p3;
-}
+	case 3:
+		p = packet[0] >> 2;
+		break;
 
-static int elantech_debounce_check_v2(struct psmouse *psmouse)
-{
-        /*
-         * When we encounter packet that matches this exactly, it means the
-         * hardware is in debounce status. Just ignore the whole packet.
-         */
-        const u8 debounce_packet[] = { 0x84, 0xff, 0xff, 0x02, 0xff, 0xff };
-        unsigned char *packet = psmouse->packet;
-
-        return !memcmp(packet, debounce_packet, sizeof(debounce_packet));
+	default:
+		return true;
+	}
+
+	return elantech_parity[packet[idx]] == (p & 1);
 }
 
-static int elantech_packet_check_v2(struct psmouse *psmouse)
+static bool elantech_check_byte_v2(struct elantech_data *etd,
+				   const unsigned char *packet, int idx)
 {
-	struct elantech_data *etd = psmouse->private;
-	unsigned char *packet = psmouse->packet;
-
 	/*
 	 * V2 hardware has two flavors. Older ones that do not report pressure,
 	 * and newer ones that reports pressure and width. With newer ones, all
@@ -668,92 +880,176 @@ static int elantech_packet_check_v2(struct psmouse *psmouse)
 	 * With all three cases, if the constant bits are not exactly what I
 	 * expected, I consider them invalid.
 	 */
-	if (etd->reports_pressure)
-		return (packet[0] & 0x0c) == 0x04 &&
-		       (packet[3] & 0x0f) == 0x02;
-
-	if ((packet[0] & 0xc0) == 0x80)
-		return (packet[0] & 0x0c) == 0x0c &&
-		       (packet[3] & 0x0e) == 0x08;
-
-	return (packet[0] & 0x3c) == 0x3c &&
-	       (packet[1] & 0xf0) == 0x00 &&
-	       (packet[3] & 0x3e) == 0x38 &&
-	       (packet[4] & 0xf0) == 0x00;
+	bool two_fingers = (packet[0] & 0xc0) == 0x80;
+
+	switch (idx) {
+	case 0:
+		if (etd->reports_pressure)
+			return (packet[0] & 0x0c) == 0x04;
+		if (two_fingers)
+			return (packet[0] & 0x0c) == 0x0c;
+		return (packet[0] & 0x3c) == 0x3c;
+
+	case 1:
+	case 4:
+		if (etd->reports_pressure || two_fingers)
+			return true;
+		return (packet[idx] & 0xf0) == 0x00;
+
+	case 3:
+		if (etd->reports_pressure)
+			return (packet[3] & 0x0f) == 0x02;
+		if (two_fingers)
+			return (packet[3] & 0x0e) == 0x08;
+		return (packet[3] & 0x3e) == 0x38;
+	}
+
+	return true;
 }
 
 /*
  * We check the constant bits to determine what packet type we get,
  * so packet checking is mandatory for v3 and later hardware.
+ * If the hardware flag 'crc_enabled' is set the packets have
+ * different signatures.
  */
-static int elantech_packet_check_v3(struct psmouse *psmouse)
+static bool elantech_check_byte_v3(struct elantech_data *etd,
+				   const unsigned char *packet, int idx)
 {
-	struct elantech_data *etd = psmouse->private;
-	const u8 debounce_packet[] = { 0xc4, 0xff, 0xff, 0x02, 0xff, 0xff };
-	unsigned char *packet = psmouse->packet;
+	switch (idx) {
+	case 0:
+		return etd->crc_enabled || (packet[0] & 0x04) == 0x04;
 
-	/*
-	 * check debounce first, it has the same signature in byte 0
-	 * and byte 3 as PACKET_V3_HEAD.
-	 */
-	if (!memcmp(packet, debounce_packet, sizeof(debounce_packet)))
-		return PACKET_DEBOUNCE;
+	case 3:
+		if (etd->crc_enabled)
+			return (packet[3] & 0x08) == 0x08;
+		if ((packet[0] & 0x0c) == 0x04)
+			return (packet[3] & 0xcf) == 0x02;
+		return (packet[3] & 0xce) == 0x0c;
+	}
 
-	/*
-	 * If the hardware flag 'crc_enabled' is set the packets have
-	 * different signatures.
-	 */
-	if (etd->crc_enabled) {
-		if ((packet[3] & 0x09) == 0x08)
-			return PACKET_V3_HEAD;
+	return true;
+}
 
-		if ((packet[3] & 0x09) == 0x09)
-			return PACKET_V3_TAIL;
-	} else {
-		if ((packet[0] & 0x0c) == 0x04 && (packet[3] & 0xcf) == 0x02)
-			return PACKET_V3_HEAD;
+/*
+ * The constant bits of v4 packets change depending on the value of
+ * the hardware flag 'crc_enabled' but are the same for every packet,
+ * regardless of the type.
+ */
+static bool elantech_check_byte_v4(struct elantech_data *etd,
+				   const unsigned char *packet, int idx)
+{
+	switch (idx) {
+	case 0:
+		return etd->crc_enabled || (packet[0] & 0x0c) == 0x04;
+
+	case 3:
+		if ((packet[3] & 0x03) == 0x03)
+			return false;
+		if (etd->crc_enabled)
+			return (packet[3] & 0x08) == 0x00;
+		return (packet[3] & 0x1c) == 0x10;
+	}
+
+	return true;
+}
+
+static bool elantech_check_constant_bits(struct elantech_data *etd,
+					 const unsigned char *packet, int idx)
+{
+	switch (etd->hw_version) {
+	case 1:
+		return !etd->paritycheck ||
+			elantech_check_byte_v1(etd, packet, idx);
+
+	case 2:
+		return !etd->paritycheck ||
+			elantech_check_byte_v2(etd, packet, idx);
+
+	case 3:
+		return elantech_check_byte_v3(etd, packet, idx);
 
-		if ((packet[0] & 0x0c) == 0x0c && (packet[3] & 0xce) == 0x0c)
-			return PACKET_V3_TAIL;
+	case 4:
+		return elantech_check_byte_v4(etd, packet, idx);
 	}
 
-	return PACKET_UNKNOWN;
+	return true;
+}
+
+/*
+ * Validate packet byte 'idx' as soon as it arrives so that a stream that
+ * lost sync is rejected at the first impossible byte rather than after a
+ * complete packet. While the bytes received so far match the debounce
+ * packet the regular checks are deferred; should the packet turn out not
+ * to be a debounce packet after all, the deferred bytes are checked then.
+ */
+static bool elantech_check_byte(struct psmouse *psmouse, int idx)
+{
+	struct elantech_data *etd = psmouse->private;
+	const unsigned char *packet = psmouse->packet;
+	const unsigned char *debounce;
+	bool was_debounce;
+	int i;
+
+	switch (etd->hw_version) {
+	case 2:
+		debounce = elantech_debounce_v2;
+		break;
+
+	case 3:
+		debounce = elantech_debounce_v3;
+		break;
+
+	default:
+		return elantech_check_constant_bits(etd, packet, idx);
+	}
+
+	was_debounce = idx > 0 && etd->debounce;
+	etd->debounce = (idx == 0 || was_debounce) &&
+			packet[idx] == debounce[idx];
+	if (etd->debounce)
+		return true;
+
+	if (was_debounce)
+		for (i = 0; i < idx; i++)
+			if (!elantech_check_constant_bits(etd, packet, i))
+				return false;
+
+	return elantech_check_constant_bits(etd, packet, idx);
 }
 
-static int elantech_packet_check_v4(struct psmouse *psmouse)
+/*
+ * Classify a complete packet whose bytes all passed elantech_check_byte()
+ */
+static int elantech_packet_type(struct psmouse *psmouse)
 {
 	struct elantech_data *etd = psmouse->private;
 	unsigned char *packet = psmouse->packet;
-	unsigned char packet_type = packet[3] & 0x03;
-	bool sanity_check;
 
-	/*
-	 * Sanity check based on the constant bits of a packet.
-	 * The constant bits change depending on the value of
-	 * the hardware flag 'crc_enabled' but are the same for
-	 * every packet, regardless of the type.
-	 */
-	if (etd->crc_enabled)
-		sanity_check = ((packet[3] & 0x08) == 0x00);
-	else
-		sanity_check = ((packet[0] & 0x0c) == 0x04 &&
-				(packet[3] & 0x1c) == 0x10);
+	if (etd->debounce)
+		return PACKET_DEBOUNCE;
 
-	if (!sanity_check)
-		return PACKET_UNKNOWN;
+	switch (etd->hw_version) {
+	case 3:
+		if (etd->crc_enabled)
+			return (packet[3] & 0x01) ? PACKET_V3_TAIL : PACKET_V3_HEAD;
+		return (packet[0] & 0x0c) == 0x04 ? PACKET_V3_HEAD : PACKET_V3_TAIL;
 
-	switch (packet_type) {
-	case 0:
-		return PACKET_V4_STATUS;
+	case 4:
+		switch (packet[3] & 0x03) {
+		case 0:
+			return PACKET_V4_STATUS;
 
-	case 1:
-		return PACKET_V4_HEAD;
+		case 1:
+			return PACKET_V4_HEAD;
 
-	case 2:
-		return PACKET_V4_MOTION;
+		case 2:
+			return PACKET_V4_MOTION;
+		}
+		return PACKET_UNKNOWN;
 	}
 
-	return PACKET_UNKNOWN;
+	return PACKET_NORMAL;
 }
 
 /*
@@ -764,48 +1060,39 @@ static psmouse_ret_t elantech_process_byte(struct psmouse *psmouse)
 	struct elantech_data *etd = psmouse->private;
 	int packet_type;
 
+	if (!elantech_check_byte(psmouse, psmouse->pktcnt - 1)) {
+		elantech_packet_record(psmouse, PACKET_UNKNOWN);
+		return PSMOUSE_BAD_DATA;
+	}
+
 	if (psmouse->pktcnt < psmouse->pktsize)
 		return PSMOUSE_GOOD_DATA;
 
-	if (etd->debug > 1)
-		elantech_packet_dump(psmouse);
+	packet_type = elantech_packet_type(psmouse);
+
+	elantech_packet_record(psmouse, packet_type);
+
+	/* ignore debounce */
+	if (packet_type == PACKET_DEBOUNCE)
+		return PSMOUSE_FULL_PACKET;
+
+	if (packet_type == PACKET_UNKNOWN)
+		return PSMOUSE_BAD_DATA;
 
 	switch (etd->hw_version) {
 	case 1:
-		if (etd->paritycheck && !elantech_packet_check_v1(psmouse))
-			return PSMOUSE_BAD_DATA;
-
 		elantech_report_absolute_v1(psmouse);
 		break;
 
 	case 2:
-		/* ignore debounce */
-		if (elantech_debounce_check_v2(psmouse))
-			return PSMOUSE_FULL_PACKET;
-
-		if (etd->paritycheck && !elantech_packet_check_v2(psmouse))
-			return PSMOUSE_BAD_DATA;
-
 		elantech_report_absolute_v2(psmouse);
 		break;
 
 	case 3:
-		packet_type = elantech_packet_check_v3(psmouse);
-		/* ignore debounce */
-		if (packet_type == PACKET_DEBOUNCE)
-			return PSMOUSE_FULL_PACKET;
-
-		if (packet_type == PACKET_UNKNOWN)
-			return PSMOUSE_BAD_DATA;
-
 		elantech_report_absolute_v3(psmouse, packet_type);
 		break;
 
 	case 4:
-		packet_type = elantech_packet_check_v4(psmouse);
-		if (packet_type == PACKET_UNKNOWN)
-			return PSMOUSE_BAD_DATA;
-
 		elantech_report_absolute_v4(psmouse, packet_type);
 		break;
 	}
@@ -814,65 +1101,28 @@ static psmouse_ret_t elantech_process_byte(struct psmouse *psmouse)
 }
 
 /*
- * Put the touchpad into absolute mode
+ * Write out the queued registers and make sure the touchpad took them
  */
-static int elantech_set_absolute_mode(struct psmouse *psmouse)
+static int elantech_apply_regs(struct psmouse *psmouse)
 {
 	struct elantech_data *etd = psmouse->private;
 	unsigned char val;
 	int tries = ETP_READ_BACK_TRIES;
-	int rc = 0;
-
-	switch (etd->hw_version) {
-	case 1:
-		etd->reg_10 = 0x16;
-		etd->reg_11 = 0x8f;
-		if (elantech_write_reg(psmouse, 0x10, etd->reg_10) ||
-		    elantech_write_reg(psmouse, 0x11, etd->reg_11)) {
-			rc = -1;
-		}
-		break;
-
-	case 2:
-					/* Windows driver values */
-		etd->reg_10 = 0x54;
-		etd->reg_11 = 0x88;	/* 0x8a */
-		etd->reg_21 = 0x60;	/* 0x00 */
-		if (elantech_write_reg(psmouse, 0x10, etd->reg_10) ||
-		    elantech_write_reg(psmouse, 0x11, etd->reg_11) ||
-		    elantech_write_reg(psmouse, 0x21, etd->reg_21)) {
-			rc = -1;
-		}
-		break;
-
-	case 3:
-		if (etd->set_hw_resolution)
-			etd->reg_10 = 0x0b;
-		else
-			etd->reg_10 = 0x01;
-
-		if (elantech_write_reg(psmouse, 0x10, etd->reg_10))
-			rc = -1;
-
-		break;
-
-	case 4:
-		etd->reg_07 = 0x01;
-		if (elantech_write_reg(psmouse, 0x07, etd->reg_07))
-			rc = -1;
+	int rc;
 
-		goto skip_readback_reg_10; /* v4 has no reg 0x10 to read */
-	}
+	rc = elantech_flush_regs(psmouse);
 
-	if (rc == 0) {
+	/* v4 has no reg 0x10 to read */
+	if (rc == 0 && etd->hw_version != 4) {
 		/*
 		 * Read back reg 0x10. For hardware version 1 we must make
 		 * sure the absolute mode bit is set. For hardware version 2
 		 * the touchpad is probably initializing and not ready until
-		 * we read back the value we just wrote.
+		 * we read back the value we just wrote. Bypass the cache,
+		 * we want to hear it from the hardware.
 		 */
 		do {
-			rc = elantech_read_reg(psmouse, 0x10, &val);
+			rc = __elantech_read_reg(psmouse, 0x10, &val);
 			if (rc == 0)
 				break;
 			tries--;
@@ -883,21 +1133,58 @@ static int elantech_set_absolute_mode(struct psmouse *psmouse)
 		if (rc) {
 			psmouse_err(psmouse,
 				    "failed to read back register 0x10.\n");
-		} else if (etd->hw_version == 1 &&
-			   !(val & ETP_R10_ABSOLUTE_MODE)) {
-			psmouse_err(psmouse,
-				    "touchpad refuses to switch to absolute mode.\n");
-			rc = -1;
+		} else {
+			etd->regs[0x10 - ETP_REG_FIRST] = val;
+			etd->regs_valid |= ETP_REG_BIT(0x10);
+
+			if (etd->hw_version == 1 &&
+			    !(val & ETP_R10_ABSOLUTE_MODE)) {
+				psmouse_err(psmouse,
+					    "touchpad refuses to switch to absolute mode.\n");
+				rc = -1;
+			}
 		}
 	}
 
- skip_readback_reg_10:
 	if (rc)
 		psmouse_err(psmouse, "failed to initialise registers.\n");
 
 	return rc;
 }
 
+/*
+ * Put the touchpad into absolute mode
+ */
+static int elantech_set_absolute_mode(struct psmouse *psmouse)
+{
+	struct elantech_data *etd = psmouse->private;
+
+	switch (etd->hw_version) {
+	case 1:
+		elantech_queue_reg(etd, 0x10, 0x16);
+		elantech_queue_reg(etd, 0x11, 0x8f);
+		break;
+
+	case 2:
+					/* Windows driver values */
+		elantech_queue_reg(etd, 0x10, 0x54);
+		elantech_queue_reg(etd, 0x11, 0x88);	/* 0x8a */
+		elantech_queue_reg(etd, 0x21, 0x60);	/* 0x00 */
+		break;
+
+	case 3:
+		elantech_queue_reg(etd, 0x10,
+				   etd->set_hw_resolution ? 0x0b : 0x01);
+		break;
+
+	case 4:
+		elantech_queue_reg(etd, 0x07, 0x01);
+		break;
+	}
+
+	return elantech_apply_regs(psmouse);
+}
+
 static int elantech_set_range(struct psmouse *psmouse,
 			      unsigned int *x_min, unsigned int *y_min,
 			      unsigned int *x_max, unsigned int *y_max,
@@ -1167,6 +1454,25 @@ static ssize_t elantech_show_int_attr(struct psmouse *psmouse, void *data,
 	return sprintf(buf, "0x%02x\n", (attr->reg && rc) ? -1 : *reg);
 }
 
+/*
+ * Keep bits the driver depends on set in values written from userspace
+ */
+static unsigned char elantech_fixup_reg(struct elantech_data *etd,
+					unsigned char reg, unsigned char value)
+{
+	/* Do we need to preserve some bits for version 2 hardware too? */
+	if (etd->hw_version == 1) {
+		if (reg == 0x10)
+			/* Force absolute mode always on */
+			value |= ETP_R10_ABSOLUTE_MODE;
+		else if (reg == 0x11)
+			/* Force 4 byte mode always on */
+			value |= ETP_R11_4_BYTE_MODE;
+	}
+
+	return value;
+}
+
 /*
  * Write a register value by writing a sysfs entry
  */
@@ -1183,15 +1489,7 @@ static ssize_t elantech_set_int_attr(struct psmouse *psmouse,
 	if (err)
 		return err;
 
-	/* Do we need to preserve some bits for version 2 hardware too? */
-	if (etd->hw_version == 1) {
-		if (attr->reg == 0x10)
-			/* Force absolute mode always on */
-			value |= ETP_R10_ABSOLUTE_MODE;
-		else if (attr->reg == 0x11)
-			/* Force 4 byte mode always on */
-			value |= ETP_R11_4_BYTE_MODE;
-	}
+	value = elantech_fixup_reg(etd, attr->reg, value);
 
 	if (!attr->reg || elantech_write_reg(psmouse, attr->reg, value) == 0)
 		*reg = value;
@@ -1209,19 +1507,82 @@ static ssize_t elantech_set_int_attr(struct psmouse *psmouse,
 			    elantech_show_int_attr,			\
 			    elantech_set_int_attr)
 
-ELANTECH_INT_ATTR(reg_07, 0x07);
-ELANTECH_INT_ATTR(reg_10, 0x10);
-ELANTECH_INT_ATTR(reg_11, 0x11);
-ELANTECH_INT_ATTR(reg_20, 0x20);
-ELANTECH_INT_ATTR(reg_21, 0x21);
-ELANTECH_INT_ATTR(reg_22, 0x22);
-ELANTECH_INT_ATTR(reg_23, 0x23);
-ELANTECH_INT_ATTR(reg_24, 0x24);
-ELANTECH_INT_ATTR(reg_25, 0x25);
-ELANTECH_INT_ATTR(reg_26, 0x26);
+#define ELANTECH_REG_ATTR(_name, _register)				\
+	static struct elantech_attr_data elantech_attr_##_name = {	\
+		.field_offset = offsetof(struct elantech_data,		\
+				regs[(_register) - ETP_REG_FIRST]),	\
+		.reg = _register,					\
+	};								\
+	PSMOUSE_DEFINE_ATTR(_name, S_IWUSR | S_IRUGO,			\
+			    &elantech_attr_##_name,			\
+			    elantech_show_int_attr,			\
+			    elantech_set_int_attr)
+
+ELANTECH_REG_ATTR(reg_07, 0x07);
+ELANTECH_REG_ATTR(reg_10, 0x10);
+ELANTECH_REG_ATTR(reg_11, 0x11);
+ELANTECH_REG_ATTR(reg_20, 0x20);
+ELANTECH_REG_ATTR(reg_21, 0x21);
+ELANTECH_REG_ATTR(reg_22, 0x22);
+ELANTECH_REG_ATTR(reg_23, 0x23);
+ELANTECH_REG_ATTR(reg_24, 0x24);
+ELANTECH_REG_ATTR(reg_25, 0x25);
+ELANTECH_REG_ATTR(reg_26, 0x26);
 ELANTECH_INT_ATTR(debug, 0);
 ELANTECH_INT_ATTR(paritycheck, 0);
 
+/*
+ * Write several registers at once, queued and sent in a single flush so
+ * that they only cost one deactivated window.
+ *
+ * ex: 10 54 11 88 - write 0x54 into register 0x10 and 0x88 into 0x11
+ */
+static ssize_t elantech_set_regs(struct psmouse *psmouse, void *data,
+				 const char *buf, size_t count)
+{
+	struct elantech_data *etd = psmouse->private;
+	unsigned char regs[ETP_REG_COUNT], vals[ETP_REG_COUNT];
+	unsigned long reg, val;
+	const char *p = buf;
+	char *rest;
+	int i, n = 0;
+
+	while (n < ETP_REG_COUNT) {
+		p = skip_spaces(p);
+		if (*p == '\0')
+			break;
+
+		reg = simple_strtoul(p, &rest, 16);
+		if (rest == p || !isspace(*rest) || reg > 0xff ||
+		    !elantech_reg_implemented(reg))
+			return -EINVAL;
+
+		p = skip_spaces(rest);
+		val = simple_strtoul(p, &rest, 16);
+		if (rest == p || val > 0xff)
+			return -EINVAL;
+
+		regs[n] = reg;
+		vals[n] = val;
+		n++;
+		p = rest;
+	}
+
+	if (n == 0 || *skip_spaces(p) != '\0')
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		elantech_queue_reg(etd, regs[i],
+				   elantech_fixup_reg(etd, regs[i], vals[i]));
+
+	if (elantech_flush_regs(psmouse))
+		return -EIO;
+
+	return count;
+}
+
+PSMOUSE_DEFINE_WO_ATTR(regs, S_IWUSR, NULL, elantech_set_regs);
+
 static struct attribute *elantech_attrs[] = {
 	&psmouse_attr_reg_07.dattr.attr,
 	&psmouse_attr_reg_10.dattr.attr,
@@ -1235,6 +1596,7 @@ static struct attribute *elantech_attrs[] = {
 	&psmouse_attr_reg_26.dattr.attr,
 	&psmouse_attr_debug.dattr.attr,
 	&psmouse_attr_paritycheck.dattr.attr,
+	&psmouse_attr_regs.dattr.attr,
 	NULL
 };
 
@@ -1326,11 +1688,66 @@ int elantech_detect(struct psmouse *psmouse, bool set_properties)
 	return 0;
 }
 
+static const char * const elantech_packet_type_names[] = {
+	[PACKET_UNKNOWN]	= "unknown",
+	[PACKET_DEBOUNCE]	= "debounce",
+	[PACKET_V3_HEAD]	= "v3-head",
+	[PACKET_V3_TAIL]	= "v3-tail",
+	[PACKET_V4_HEAD]	= "v4-head",
+	[PACKET_V4_MOTION]	= "v4-motion",
+	[PACKET_V4_STATUS]	= "v4-status",
+	[PACKET_NORMAL]		= "normal",
+};
+
+static void elantech_trace_header(struct seq_file *s, struct psmouse *psmouse)
+{
+	struct elantech_data *etd = psmouse->private;
+
+	seq_printf(s, "# elantech hw_version %d fw_version 0x%06x\n",
+		   etd->hw_version, etd->fw_version);
+}
+
 /*
- * Clean up sysfs entries when disconnecting
+ * Rejected packets are traced as "unknown" with the bytes received up
+ * to and including the offending one.
+ */
+static const struct psmouse_trace_format elantech_trace_format = {
+	.name		= "elantech",
+	.type_names	= elantech_packet_type_names,
+	.num_types	= ARRAY_SIZE(elantech_packet_type_names),
+	.show_header	= elantech_trace_header,
+};
+
+/*
+ * Export the packet trace ring and, for v4 hardware, frame assembly
+ * statistics through debugfs
+ */
+static void elantech_debugfs_init(struct psmouse *psmouse)
+{
+	struct elantech_data *etd = psmouse->private;
+	struct dentry *dir;
+
+	psmouse_trace_init(&etd->trace, psmouse, &elantech_trace_format);
+
+	dir = etd->trace.dir;
+	if (!dir || etd->hw_version != 4)
+		return;
+
+	debugfs_create_u32("frame_count", S_IRUGO, dir, &etd->frame_count);
+	debugfs_create_u32("frame_packets", S_IRUGO, dir, &etd->frame_packets);
+	debugfs_create_u64("frame_last_ns", S_IRUGO, dir, &etd->frame_last_ns);
+	debugfs_create_u64("frame_max_ns", S_IRUGO, dir, &etd->frame_max_ns);
+}
+
+/*
+ * Clean up sysfs and debugfs entries when disconnecting
  */
 static void elantech_disconnect(struct psmouse *psmouse)
 {
+	struct elantech_data *etd = psmouse->private;
+
+	del_timer_sync(&etd->frame_timer);
+	psmouse_trace_cleanup(&etd->trace);
 	sysfs_remove_group(&psmouse->ps2dev.serio->dev.kobj,
 			   &elantech_attr_group);
 	kfree(psmouse->private);
@@ -1338,16 +1755,30 @@ static void elantech_disconnect(struct psmouse *psmouse)
 }
 
 /*
- * Put the touchpad back into absolute mode when reconnecting
+ * Put the touchpad back into absolute mode when reconnecting, replaying
+ * all registers we have written so settings made through sysfs survive
+ * a reset.
  */
 static int elantech_reconnect(struct psmouse *psmouse)
 {
+	struct elantech_data *etd = psmouse->private;
+
 	psmouse_reset(psmouse);
 
+	etd->regs_valid = 0;
+	etd->regs_dirty = etd->regs_written;
+	memcpy(etd->regs_prev, etd->regs, sizeof(etd->regs));
+	etd->regs_prev_valid = 0;
+	etd->regs_prev_written = etd->regs_written;
+
+	del_timer_sync(&etd->frame_timer);
+	etd->fingers_v4 = etd->frame_slots = 0;
+	etd->frame_open = false;
+
 	if (elantech_detect(psmouse, 0))
 		return -1;
 
-	if (elantech_set_absolute_mode(psmouse)) {
+	if (elantech_apply_regs(psmouse)) {
 		psmouse_err(psmouse,
 			    "failed to put touchpad back into absolute mode.\n");
 		return -1;
@@ -1445,18 +1876,17 @@ static int elantech_set_properties(struct elantech_data *etd)
 int elantech_init(struct psmouse *psmouse)
 {
 	struct elantech_data *etd;
-	int i, error;
+	int error;
 	unsigned char param[3];
 
 	psmouse->private = etd = kzalloc(sizeof(struct elantech_data), GFP_KERNEL);
 	if (!etd)
 		return -ENOMEM;
 
-	psmouse_reset(psmouse);
+	setup_timer(&etd->frame_timer, elantech_frame_timeout_v4,
+		    (unsigned long)psmouse);
 
-	etd->parity[0] = 1;
-	for (i = 1; i < 256; i++)
-		etd->parity[i] = etd->parity[i & (i - 1)] ^ 1;
+	psmouse_reset(psmouse);
 
 	/*
 	 * Do the version query again so we can store the result
@@ -1505,6 +1935,8 @@ int elantech_init(struct psmouse *psmouse)
 		goto init_fail;
 	}
 
+	elantech_debugfs_init(psmouse);
+
 	psmouse->protocol_handler = elantech_process_byte;
 	psmouse->disconnect = elantech_disconnect;
 	psmouse->reconnect = elantech_reconnect;
@@ -29,6 +29,15 @@
 #define ETP_REGISTER_WRITE		0x11
 #define ETP_REGISTER_READWRITE		0x00
 
+/*
+ * Range of registers accessible with the above commands; 0x12 - 0x1f
+ * are not implemented by the hardware.
+ */
+#define ETP_REG_FIRST			0x07
+#define ETP_REG_LAST			0x26
+#define ETP_REG_COUNT			(ETP_REG_LAST - ETP_REG_FIRST + 1)
+#define ETP_REG_BIT(reg)		(1U << ((reg) - ETP_REG_FIRST))
+
 /*
  * Hardware version 2 custom PS/2 command value
  */
@@ -84,6 +93,7 @@
 #define ETP_WMAX_V2			15
 
 /*
+ * v1 and v2 hardware have a single packet type,
  * v3 hardware has 2 kinds of packet types,
  * v4 hardware has 3.
  */
@@ -94,6 +104,7 @@
 #define PACKET_V4_HEAD			0x05
 #define PACKET_V4_MOTION		0x06
 #define PACKET_V4_STATUS		0x07
+#define PACKET_NORMAL			0x08
 
 /*
  * track up to 5 fingers for v4 hardware
@@ -105,6 +116,11 @@
  */
 #define ETP_WEIGHT_VALUE		5
 
+/*
+ * How long a v4 frame may stay incomplete before it is synced anyway, in ms
+ */
+#define ETP_FRAME_TIMEOUT		20
+
 /*
  * The base position for one finger, v4 hardware
  */
@@ -114,22 +130,20 @@ struct finger_pos {
 };
 
 struct elantech_data {
-	unsigned char reg_07;
-	unsigned char reg_10;
-	unsigned char reg_11;
-	unsigned char reg_20;
-	unsigned char reg_21;
-	unsigned char reg_22;
-	unsigned char reg_23;
-	unsigned char reg_24;
-	unsigned char reg_25;
-	unsigned char reg_26;
+	unsigned char regs[ETP_REG_COUNT];	/* register cache */
+	u32 regs_valid;			/* cache entry matches the hardware */
+	u32 regs_dirty;			/* cache entry waiting to be written */
+	u32 regs_written;		/* accepted write to replay on reconnect */
+	unsigned char regs_prev[ETP_REG_COUNT];	/* cache before queued writes */
+	u32 regs_prev_valid;
+	u32 regs_prev_written;
 	unsigned char debug;
 	unsigned char capabilities[3];
 	bool paritycheck;
 	bool jumpy_cursor;
 	bool reports_pressure;
 	bool crc_enabled;
+	bool debounce;			/* packet so far is a debounce packet */
 	bool set_hw_resolution;
 	unsigned char hw_version;
 	unsigned int fw_version;
@@ -137,7 +151,21 @@ struct elantech_data {
 	unsigned int y_max;
 	unsigned int width;
 	struct finger_pos mt[ETP_MAX_FINGERS];
-	unsigned char parity[256];
+
+	/* v4 frame assembly: one input_sync per complete frame */
+	unsigned char fingers_v4;	/* fingers present per status packet */
+	unsigned char frame_slots;	/* fingers updated in pending frame */
+	bool frame_open;		/* pending frame has unsynced events */
+	ktime_t frame_start;		/* arrival of first packet in frame */
+	struct timer_list frame_timer;	/* flushes frames left open */
+	u32 frame_count;
+	u32 frame_packets;
+	u64 frame_last_ns;
+	u64 frame_max_ns;
+
+	/* Packet trace, types are the PACKET_* classification */
+	struct psmouse_trace trace;
+
 	int (*send_cmd)(struct psmouse *psmouse, unsigned char c, unsigned char *param);
 };
 
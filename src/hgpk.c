@@ -36,13 +36,12 @@
 #include <linux/serio.h>
 #include <linux/libps2.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <asm/olpc.h>
 
 #include "psmouse.h"
 #include "hgpk.h"
 
-#define ILLEGAL_XY 999999
-
 static bool tpdebug;
 module_param(tpdebug, bool, 0644);
 MODULE_PARM_DESC(tpdebug, "enable debugging, dumping packets to KERN_DEBUG.");
@@ -103,176 +102,49 @@ static int hgpk_mode_from_name(const char *buf, int len)
 	return HGPK_MODE_INVALID;
 }
 
-/*
- * see if new value is within 20% of half of old value
- */
-static int approx_half(int curr, int prev)
+static void hgpk_reset_hack_state(struct psmouse *psmouse)
 {
-	int belowhalf, abovehalf;
-
-	if (curr < 5 || prev < 5)
-		return 0;
+	struct hgpk_data *priv = psmouse->private;
 
-	belowhalf = (prev * 8) / 20;
-	abovehalf = (prev * 12) / 20;
+	priv->abs_x = priv->abs_y = -1;
+	priv->dupe_count = 0;
 
-	return belowhalf < curr && curr <= abovehalf;
+	/* pick up changes to the filter module parameters */
+	psmouse->filter.jump_delta = recalib_delta;
+	psmouse->filter.spew_count = spew_delay ? SPEW_WATCH_COUNT : 0;
+	psmouse_filter_reset(&psmouse->filter);
 }
 
 /*
- * Throw out oddly large delta packets, and any that immediately follow whose
- * values are each approximately half of the previous.  It seems that the ALPS
- * firmware emits errant packets, and they get averaged out slowly.
+ * Packets are run through the generic motion filter which throws out
+ * oddly large deltas and detects packet spew. Both are signs of a
+ * miscalibrated pad, so schedule a recalibration when the filter says so.
  */
-static int hgpk_discard_decay_hack(struct psmouse *psmouse, int x, int y)
+static bool hgpk_filter_motion(struct psmouse *psmouse,
+			       int l, int r, int x, int y)
 {
 	struct hgpk_data *priv = psmouse->private;
-	int avx, avy;
-	bool do_recal = false;
-
-	avx = abs(x);
-	avy = abs(y);
-
-	/* discard if too big, or half that but > 4 times the prev delta */
-	if (avx > recalib_delta ||
-		(avx > recalib_delta / 2 && ((avx / 4) > priv->xlast))) {
-		psmouse_warn(psmouse, "detected %dpx jump in x\n", x);
-		priv->xbigj = avx;
-	} else if (approx_half(avx, priv->xbigj)) {
-		psmouse_warn(psmouse, "detected secondary %dpx jump in x\n", x);
-		priv->xbigj = avx;
-		priv->xsaw_secondary++;
-	} else {
-		if (priv->xbigj && priv->xsaw_secondary > 1)
-			do_recal = true;
-		priv->xbigj = 0;
-		priv->xsaw_secondary = 0;
-	}
+	unsigned int flags;
 
-	if (avy > recalib_delta ||
-		(avy > recalib_delta / 2 && ((avy / 4) > priv->ylast))) {
-		psmouse_warn(psmouse, "detected %dpx jump in y\n", y);
-		priv->ybigj = avy;
-	} else if (approx_half(avy, priv->ybigj)) {
-		psmouse_warn(psmouse, "detected secondary %dpx jump in y\n", y);
-		priv->ybigj = avy;
-		priv->ysaw_secondary++;
-	} else {
-		if (priv->ybigj && priv->ysaw_secondary > 1)
-			do_recal = true;
-		priv->ybigj = 0;
-		priv->ysaw_secondary = 0;
-	}
-
-	priv->xlast = avx;
-	priv->ylast = avy;
+	flags = psmouse_filter_motion(psmouse, x, y, l || r);
 
-	if (do_recal && jumpy_delay) {
+	if ((flags & PSMOUSE_FILTER_JUMPY) && jumpy_delay) {
 		psmouse_warn(psmouse, "scheduling recalibration\n");
 		psmouse_queue_work(psmouse, &priv->recalib_wq,
 				msecs_to_jiffies(jumpy_delay));
 	}
 
-	return priv->xbigj || priv->ybigj;
-}
-
-static void hgpk_reset_spew_detection(struct hgpk_data *priv)
-{
-	priv->spew_count = 0;
-	priv->dupe_count = 0;
-	priv->x_tally = 0;
-	priv->y_tally = 0;
-	priv->spew_flag = NO_SPEW;
-}
-
-static void hgpk_reset_hack_state(struct psmouse *psmouse)
-{
-	struct hgpk_data *priv = psmouse->private;
-
-	priv->abs_x = priv->abs_y = -1;
-	priv->xlast = priv->ylast = ILLEGAL_XY;
-	priv->xbigj = priv->ybigj = 0;
-	priv->xsaw_secondary = priv->ysaw_secondary = 0;
-	hgpk_reset_spew_detection(priv);
-}
-
-/*
- * We have no idea why this particular hardware bug occurs.  The touchpad
- * will randomly start spewing packets without anything touching the
- * pad.  This wouldn't necessarily be bad, but it's indicative of a
- * severely miscalibrated pad; attempting to use the touchpad while it's
- * spewing means the cursor will jump all over the place, and act "drunk".
- *
- * The packets that are spewed tend to all have deltas between -2 and 2, and
- * the cursor will move around without really going very far.  It will
- * tend to end up in the same location; if we tally up the changes over
- * 100 packets, we end up w/ a final delta of close to 0.  This happens
- * pretty regularly when the touchpad is spewing, and is pretty hard to
- * manually trigger (at least for *my* fingers).  So, it makes a perfect
- * scheme for detecting spews.
- */
-static void hgpk_spewing_hack(struct psmouse *psmouse,
-			      int l, int r, int x, int y)
-{
-	struct hgpk_data *priv = psmouse->private;
-
-	/* ignore button press packets; many in a row could trigger
-	 * a false-positive! */
-	if (l || r)
-		return;
-
-	/* don't track spew if the workaround feature has been turned off */
-	if (!spew_delay)
-		return;
+	if (flags & PSMOUSE_FILTER_SPEW)
+		psmouse_queue_work(psmouse, &priv->recalib_wq,
+				   msecs_to_jiffies(spew_delay));
 
-	if (abs(x) > 3 || abs(y) > 3) {
-		/* no spew, or spew ended */
-		hgpk_reset_spew_detection(priv);
-		return;
+	if (flags & PSMOUSE_FILTER_DISCARD) {
+		if (tpdebug)
+			psmouse_dbg(psmouse, "discarding\n");
+		return false;
 	}
 
-	/* Keep a tally of the overall delta to the cursor position caused by
-	 * the spew */
-	priv->x_tally += x;
-	priv->y_tally += y;
-
-	switch (priv->spew_flag) {
-	case NO_SPEW:
-		/* we're not spewing, but this packet might be the start */
-		priv->spew_flag = MAYBE_SPEWING;
-
-		/* fall-through */
-
-	case MAYBE_SPEWING:
-		priv->spew_count++;
-
-		if (priv->spew_count < SPEW_WATCH_COUNT)
-			break;
-
-		/* excessive spew detected, request recalibration */
-		priv->spew_flag = SPEW_DETECTED;
-
-		/* fall-through */
-
-	case SPEW_DETECTED:
-		/* only recalibrate when the overall delta to the cursor
-		 * is really small. if the spew is causing significant cursor
-		 * movement, it is probably a case of the user moving the
-		 * cursor very slowly across the screen. */
-		if (abs(priv->x_tally) < 3 && abs(priv->y_tally) < 3) {
-			psmouse_warn(psmouse, "packet spew detected (%d,%d)\n",
-				     priv->x_tally, priv->y_tally);
-			priv->spew_flag = RECALIBRATING;
-			psmouse_queue_work(psmouse, &priv->recalib_wq,
-					   msecs_to_jiffies(spew_delay));
-		}
-
-		break;
-	case RECALIBRATING:
-		/* we already detected a spew and requested a recalibration,
-		 * just wait for the queue to kick into action. */
-		break;
-	}
+	return true;
 }
 
 /*
@@ -394,7 +266,7 @@ static void hgpk_process_advanced_packet(struct psmouse *psmouse)
 		if (++priv->dupe_count > SPEW_WATCH_COUNT) {
 			if (tpdebug)
 				psmouse_dbg(psmouse, "hard spew detected\n");
-			priv->spew_flag = RECALIBRATING;
+			psmouse->filter.spew_state = PSMOUSE_SPEW_REPORTED;
 			psmouse_queue_work(psmouse, &priv->recalib_wq,
 					   msecs_to_jiffies(spew_delay));
 		}
@@ -408,12 +280,8 @@ static void hgpk_process_advanced_packet(struct psmouse *psmouse)
 	if (priv->mode != HGPK_MODE_PENTABLET && priv->abs_x != -1) {
 		int x_diff = priv->abs_x - x;
 		int y_diff = priv->abs_y - y;
-		if (hgpk_discard_decay_hack(psmouse, x_diff, y_diff)) {
-			if (tpdebug)
-				psmouse_dbg(psmouse, "discarding\n");
+		if (!hgpk_filter_motion(psmouse, left, right, x_diff, y_diff))
 			goto done;
-		}
-		hgpk_spewing_hack(psmouse, left, right, x_diff, y_diff);
 	}
 
 	input_report_abs(idev, ABS_X, x);
@@ -439,13 +307,8 @@ static void hgpk_process_simple_packet(struct psmouse *psmouse)
 			    "overflow -- 0x%02x 0x%02x 0x%02x\n",
 			    packet[0], packet[1], packet[2]);
 
-	if (hgpk_discard_decay_hack(psmouse, x, y)) {
-		if (tpdebug)
-			psmouse_dbg(psmouse, "discarding\n");
+	if (!hgpk_filter_motion(psmouse, left, right, x, y))
 		return;
-	}
-
-	hgpk_spewing_hack(psmouse, left, right, x, y);
 
 	if (tpdebug)
 		psmouse_dbg(psmouse, "l=%d r=%d x=%d y=%d\n",
@@ -475,8 +338,8 @@ static psmouse_ret_t hgpk_process_byte(struct psmouse *psmouse)
 		return PSMOUSE_FULL_PACKET;
 	}
 
-	if (priv->recalib_window) {
-		if (time_before(jiffies, priv->recalib_window)) {
+	if (priv->recal_state == HGPK_RECAL_GUARD) {
+		if (time_before(jiffies, priv->recal_guard_end)) {
 			/*
 			 * ugh, got a packet inside our recalibration
 			 * window, schedule another recalibration.
@@ -486,7 +349,7 @@ static psmouse_ret_t hgpk_process_byte(struct psmouse *psmouse)
 			psmouse_queue_work(psmouse, &priv->recalib_wq,
 					msecs_to_jiffies(post_interrupt_delay));
 		}
-		priv->recalib_window = 0;
+		priv->recal_state = HGPK_RECAL_IDLE;
 	}
 
 	return PSMOUSE_GOOD_DATA;
@@ -603,27 +466,12 @@ static void hgpk_setup_input_device(struct input_dev *input,
 	}
 }
 
-static int hgpk_reset_device(struct psmouse *psmouse, bool recalibrate)
+static int hgpk_reset_device(struct psmouse *psmouse)
 {
 	int err;
 
 	psmouse_reset(psmouse);
 
-	if (recalibrate) {
-		struct ps2dev *ps2dev = &psmouse->ps2dev;
-
-		/* send the recalibrate request */
-		if (ps2_command(ps2dev, NULL, 0xf5) ||
-		    ps2_command(ps2dev, NULL, 0xf5) ||
-		    ps2_command(ps2dev, NULL, 0xe6) ||
-		    ps2_command(ps2dev, NULL, 0xf5)) {
-			return -1;
-		}
-
-		/* according to ALPS, 150mS is required for recalibration */
-		msleep(150);
-	}
-
 	err = hgpk_select_mode(psmouse);
 	if (err) {
 		psmouse_err(psmouse, "failed to select mode\n");
@@ -635,10 +483,23 @@ static int hgpk_reset_device(struct psmouse *psmouse, bool recalibrate)
 	return 0;
 }
 
-static int hgpk_force_recalibrate(struct psmouse *psmouse)
+/*
+ * Recalibration runs from the psmouse workqueue as a state machine so that
+ * the 150ms the touchpad needs to recalibrate is spent waiting for the
+ * next step to be scheduled instead of sleeping and holding up work
+ * queued for other ports:
+ *
+ *  IDLE/GUARD -> SETTLE	reset the device, send the recalibrate request
+ *  SETTLE -> GUARD/IDLE	select the mode and reactivate the device
+ *
+ * While in GUARD, for recal_guard_time after reactivation, a packet
+ * received from the touchpad queues another recalibration after
+ * post_interrupt_delay (see hgpk_process_byte()).
+ */
+static int hgpk_recal_start(struct psmouse *psmouse)
 {
 	struct hgpk_data *priv = psmouse->private;
-	int err;
+	struct ps2dev *ps2dev = &psmouse->ps2dev;
 
 	/* C-series touchpads added the recalibrate command */
 	if (psmouse->model < HGPK_MODEL_C)
@@ -654,10 +515,41 @@ static int hgpk_force_recalibrate(struct psmouse *psmouse)
 	/* we don't want to race with the irq handler, nor with resyncs */
 	psmouse_set_state(psmouse, PSMOUSE_INITIALIZING);
 
+	priv->recal_state = HGPK_RECAL_IDLE;
+	priv->recal_start = ktime_get();
+
 	/* start by resetting the device */
-	err = hgpk_reset_device(psmouse, true);
-	if (err)
+	psmouse_reset(psmouse);
+
+	/* send the recalibrate request */
+	if (ps2_command(ps2dev, NULL, 0xf5) ||
+	    ps2_command(ps2dev, NULL, 0xf5) ||
+	    ps2_command(ps2dev, NULL, 0xe6) ||
+	    ps2_command(ps2dev, NULL, 0xf5)) {
+		return -1;
+	}
+
+	/* according to ALPS, 150mS is required for recalibration */
+	priv->recal_state = HGPK_RECAL_SETTLE;
+	psmouse_queue_work(psmouse, &priv->recalib_wq, msecs_to_jiffies(150));
+
+	return 0;
+}
+
+static int hgpk_recal_finish(struct psmouse *psmouse)
+{
+	struct hgpk_data *priv = psmouse->private;
+	int err;
+
+	priv->recal_state = HGPK_RECAL_IDLE;
+
+	err = hgpk_select_mode(psmouse);
+	if (err) {
+		psmouse_err(psmouse, "failed to select mode\n");
 		return err;
+	}
+
+	hgpk_reset_hack_state(psmouse);
 
 	/*
 	 * XXX: If a finger is down during this delay, recalibration will
@@ -668,17 +560,23 @@ static int hgpk_force_recalibrate(struct psmouse *psmouse)
 	if (psmouse_activate(psmouse))
 		return -1;
 
+	priv->recal_msecs = ktime_to_ms(ktime_sub(ktime_get(),
+						  priv->recal_start));
+
 	if (tpdebug)
-		psmouse_dbg(psmouse, "touchpad reactivated\n");
+		psmouse_dbg(psmouse, "touchpad reactivated after %ums\n",
+			    priv->recal_msecs);
 
 	/*
 	 * If we get packets right away after recalibrating, it's likely
 	 * that a finger was on the touchpad.  If so, it's probably
 	 * miscalibrated, so we optionally schedule another.
 	 */
-	if (recal_guard_time)
-		priv->recalib_window = jiffies +
+	if (recal_guard_time) {
+		priv->recal_guard_end = jiffies +
 			msecs_to_jiffies(recal_guard_time);
+		priv->recal_state = HGPK_RECAL_GUARD;
+	}
 
 	return 0;
 }
@@ -719,7 +617,7 @@ static int hgpk_toggle_powersave(struct psmouse *psmouse, int enable)
 			msleep(25);
 		}
 
-		err = hgpk_reset_device(psmouse, false);
+		err = hgpk_reset_device(psmouse);
 		if (err) {
 			psmouse_err(psmouse, "Failed to reset device!\n");
 			return err;
@@ -767,7 +665,7 @@ static int hgpk_reconnect(struct psmouse *psmouse)
 			return 0;
 
 	priv->powered = 1;
-	return hgpk_reset_device(psmouse, false);
+	return hgpk_reset_device(psmouse);
 }
 
 static ssize_t hgpk_show_powered(struct psmouse *psmouse, void *data, char *buf)
@@ -838,7 +736,7 @@ static ssize_t attr_set_mode(struct psmouse *psmouse, void *data,
 
 	/* Switch device into the new mode */
 	priv->mode = new_mode;
-	err = hgpk_reset_device(psmouse, false);
+	err = hgpk_reset_device(psmouse);
 	if (err)
 		goto err_try_restore;
 
@@ -858,7 +756,7 @@ static ssize_t attr_set_mode(struct psmouse *psmouse, void *data,
 err_try_restore:
 	input_free_device(new_dev);
 	priv->mode = old_mode;
-	hgpk_reset_device(psmouse, false);
+	hgpk_reset_device(psmouse);
 
 	return err;
 }
@@ -888,7 +786,7 @@ static ssize_t hgpk_trigger_recal(struct psmouse *psmouse, void *data,
 
 	/*
 	 * We queue work instead of doing recalibration right here
-	 * to avoid adding locking to to hgpk_force_recalibrate()
+	 * to avoid adding locking to the recalibration state machine
 	 * since workqueue provides serialization.
 	 */
 	psmouse_queue_work(psmouse, &priv->recalib_wq, 0);
@@ -898,6 +796,16 @@ static ssize_t hgpk_trigger_recal(struct psmouse *psmouse, void *data,
 __PSMOUSE_DEFINE_ATTR(recalibrate, S_IWUSR | S_IRUGO, NULL,
 		      hgpk_trigger_recal_show, hgpk_trigger_recal, false);
 
+static ssize_t hgpk_show_recal_msecs(struct psmouse *psmouse,
+				     void *data, char *buf)
+{
+	struct hgpk_data *priv = psmouse->private;
+
+	return sprintf(buf, "%u\n", priv->recal_msecs);
+}
+
+PSMOUSE_DEFINE_RO_ATTR(recal_msecs, S_IRUGO, NULL, hgpk_show_recal_msecs);
+
 static void hgpk_disconnect(struct psmouse *psmouse)
 {
 	struct hgpk_data *priv = psmouse->private;
@@ -907,10 +815,14 @@ static void hgpk_disconnect(struct psmouse *psmouse)
 	device_remove_file(&psmouse->ps2dev.serio->dev,
 			   &psmouse_attr_hgpk_mode.dattr);
 
-	if (psmouse->model >= HGPK_MODEL_C)
+	if (psmouse->model >= HGPK_MODEL_C) {
 		device_remove_file(&psmouse->ps2dev.serio->dev,
 				   &psmouse_attr_recalibrate.dattr);
+		device_remove_file(&psmouse->ps2dev.serio->dev,
+				   &psmouse_attr_recal_msecs.dattr);
+	}
 
+	cancel_delayed_work_sync(&priv->recalib_wq);
 	psmouse_reset(psmouse);
 	kfree(priv);
 }
@@ -920,8 +832,14 @@ static void hgpk_recalib_work(struct work_struct *work)
 	struct delayed_work *w = to_delayed_work(work);
 	struct hgpk_data *priv = container_of(w, struct hgpk_data, recalib_wq);
 	struct psmouse *psmouse = priv->psmouse;
+	int err;
+
+	if (priv->recal_state == HGPK_RECAL_SETTLE)
+		err = hgpk_recal_finish(psmouse);
+	else
+		err = hgpk_recal_start(psmouse);
 
-	if (hgpk_force_recalibrate(psmouse))
+	if (err)
 		psmouse_err(psmouse, "recalibration failed!\n");
 }
 
@@ -967,10 +885,21 @@ static int hgpk_register(struct psmouse *psmouse)
 				    "Failed creating 'recalibrate' sysfs node\n");
 			goto err_remove_mode;
 		}
+
+		err = device_create_file(&psmouse->ps2dev.serio->dev,
+					 &psmouse_attr_recal_msecs.dattr);
+		if (err) {
+			psmouse_err(psmouse,
+				    "Failed creating 'recal_msecs' sysfs node\n");
+			goto err_remove_recalibrate;
+		}
 	}
 
 	return 0;
 
+err_remove_recalibrate:
+	device_remove_file(&psmouse->ps2dev.serio->dev,
+			   &psmouse_attr_recalibrate.dattr);
 err_remove_mode:
 	device_remove_file(&psmouse->ps2dev.serio->dev,
 			   &psmouse_attr_hgpk_mode.dattr);
@@ -998,7 +927,7 @@ int hgpk_init(struct psmouse *psmouse)
 	priv->mode = hgpk_default_mode;
 	INIT_DELAYED_WORK(&priv->recalib_wq, hgpk_recalib_work);
 
-	err = hgpk_reset_device(psmouse, false);
+	err = hgpk_reset_device(psmouse);
 	if (err)
 		goto init_fail;
 
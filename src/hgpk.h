@@ -16,15 +16,14 @@ enum hgpk_model_t {
 	HGPK_MODEL_D = 0x50,	/* C1, mass production */
 };
 
-enum hgpk_spew_flag {
-	NO_SPEW,
-	MAYBE_SPEWING,
-	SPEW_DETECTED,
-	RECALIBRATING,
-};
-
 #define SPEW_WATCH_COUNT 42  /* at 12ms/packet, this is 1/2 second */
 
+enum hgpk_recal_state {
+	HGPK_RECAL_IDLE,
+	HGPK_RECAL_SETTLE,	/* recalibrate request sent, waiting 150ms */
+	HGPK_RECAL_GUARD,	/* reactivated, inside recal_guard_time */
+};
+
 enum hgpk_mode {
 	HGPK_MODE_MOUSE,
 	HGPK_MODE_GLIDESENSOR,
@@ -36,14 +35,13 @@ struct hgpk_data {
 	struct psmouse *psmouse;
 	enum hgpk_mode mode;
 	bool powered;
-	enum hgpk_spew_flag spew_flag;
-	int spew_count, x_tally, y_tally;	/* spew detection */
-	unsigned long recalib_window;
+	enum hgpk_recal_state recal_state;
+	unsigned long recal_guard_end;
+	ktime_t recal_start;
+	unsigned int recal_msecs;	/* duration of the last recalibration */
 	struct delayed_work recalib_wq;
 	int abs_x, abs_y;
 	int dupe_count;
-	int xbigj, ybigj, xlast, ylast; /* jumpiness detection */
-	int xsaw_secondary, ysaw_secondary; /* jumpiness detection */
 };
 
 #ifdef CONFIG_MOUSE_PS2_OLPC
@@ -21,7 +21,18 @@
 #include "psmouse.h"
 #include "lifebook.h"
 
+/*
+ * Packet framing used by the touchscreen on a given port.
+ */
+struct lifebook_framing {
+	psmouse_ret_t (*process_byte)(struct psmouse *psmouse);
+	unsigned char absolute_res;	/* SETRES argument enabling absolute mode */
+	int max_coord;
+	unsigned int model;
+};
+
 struct lifebook_data {
+	const struct lifebook_framing *framing;
 	struct input_dev *dev2;		/* Relative device */
 	char phys[32];
 };
@@ -131,79 +142,133 @@ void __init lifebook_module_init(void)
 	lifebook_present = dmi_check_system(lifebook_dmi_table);
 }
 
-static psmouse_ret_t lifebook_process_byte(struct psmouse *psmouse)
+/*
+ * Relative packets are always 3 bytes long, even when the touchscreen
+ * talks the 6-byte protocol, and carry the buttons shared by both
+ * devices.
+ */
+static void lifebook_report_relative(struct psmouse *psmouse,
+				     bool relative_packet)
 {
 	struct lifebook_data *priv = psmouse->private;
-	struct input_dev *dev1 = psmouse->dev;
-	struct input_dev *dev2 = priv ? priv->dev2 : NULL;
+	struct input_dev *dev2 = priv->dev2;
 	unsigned char *packet = psmouse->packet;
-	bool relative_packet = packet[0] & 0x08;
 
-	if (relative_packet || !lifebook_use_6byte_proto) {
-		if (psmouse->pktcnt != 3)
-			return PSMOUSE_GOOD_DATA;
-	} else {
-		switch (psmouse->pktcnt) {
-		case 1:
-			return (packet[0] & 0xf8) == 0x00 ?
-				PSMOUSE_GOOD_DATA : PSMOUSE_BAD_DATA;
-		case 2:
-			return PSMOUSE_GOOD_DATA;
-		case 3:
-			return ((packet[2] & 0x30) << 2) == (packet[2] & 0xc0) ?
-				PSMOUSE_GOOD_DATA : PSMOUSE_BAD_DATA;
-		case 4:
-			return (packet[3] & 0xf8) == 0xc0 ?
-				PSMOUSE_GOOD_DATA : PSMOUSE_BAD_DATA;
-		case 5:
-			return (packet[4] & 0xc0) == (packet[2] & 0xc0) ?
-				PSMOUSE_GOOD_DATA : PSMOUSE_BAD_DATA;
-		case 6:
-			if (((packet[5] & 0x30) << 2) != (packet[5] & 0xc0))
-				return PSMOUSE_BAD_DATA;
-			if ((packet[5] & 0xc0) != (packet[1] & 0xc0))
-				return PSMOUSE_BAD_DATA;
-			break; /* report data */
-		}
+	if (!dev2) {
+		if (relative_packet)
+			psmouse_warn(psmouse,
+				     "got relative packet but no relative device set up\n");
+		return;
 	}
 
 	if (relative_packet) {
-		if (!dev2)
-			psmouse_warn(psmouse,
-				     "got relative packet but no relative device set up\n");
-	} else {
-		if (lifebook_use_6byte_proto) {
-			input_report_abs(dev1, ABS_X,
-				((packet[1] & 0x3f) << 6) | (packet[2] & 0x3f));
-			input_report_abs(dev1, ABS_Y,
-				4096 - (((packet[4] & 0x3f) << 6) | (packet[5] & 0x3f)));
-		} else {
-			input_report_abs(dev1, ABS_X,
-				(packet[1] | ((packet[0] & 0x30) << 4)));
-			input_report_abs(dev1, ABS_Y,
-				1024 - (packet[2] | ((packet[0] & 0xC0) << 2)));
-		}
+		input_report_rel(dev2, REL_X,
+			((packet[0] & 0x10) ? packet[1] - 256 : packet[1]));
+		input_report_rel(dev2, REL_Y,
+			 -(int)((packet[0] & 0x20) ? packet[2] - 256 : packet[2]));
+	}
+	input_report_key(dev2, BTN_LEFT, packet[0] & 0x01);
+	input_report_key(dev2, BTN_RIGHT, packet[0] & 0x02);
+	input_sync(dev2);
+}
+
+static psmouse_ret_t lifebook_process_3byte(struct psmouse *psmouse)
+{
+	struct input_dev *dev1 = psmouse->dev;
+	unsigned char *packet = psmouse->packet;
+	bool relative_packet = packet[0] & 0x08;
+
+	if (psmouse->pktcnt != 3)
+		return PSMOUSE_GOOD_DATA;
+
+	if (psmouse_repeated_packet(psmouse, relative_packet &&
+					     (packet[1] || packet[2])))
+		return PSMOUSE_FULL_PACKET;
+
+	if (!relative_packet) {
+		input_report_abs(dev1, ABS_X,
+			(packet[1] | ((packet[0] & 0x30) << 4)));
+		input_report_abs(dev1, ABS_Y,
+			1024 - (packet[2] | ((packet[0] & 0xC0) << 2)));
 		input_report_key(dev1, BTN_TOUCH, packet[0] & 0x04);
 		input_sync(dev1);
 	}
 
-	if (dev2) {
-		if (relative_packet) {
-			input_report_rel(dev2, REL_X,
-				((packet[0] & 0x10) ? packet[1] - 256 : packet[1]));
-			input_report_rel(dev2, REL_Y,
-				 -(int)((packet[0] & 0x20) ? packet[2] - 256 : packet[2]));
-		}
-		input_report_key(dev2, BTN_LEFT, packet[0] & 0x01);
-		input_report_key(dev2, BTN_RIGHT, packet[0] & 0x02);
-		input_sync(dev2);
+	lifebook_report_relative(psmouse, relative_packet);
+
+	return PSMOUSE_FULL_PACKET;
+}
+
+/*
+ * Absolute packets of the 6-byte protocol: bits 5-4 of bytes 2 and 5
+ * repeat their bits 7-6, and the top bits of bytes 4 and 5 repeat those
+ * of bytes 2 and 1.
+ */
+static const struct psmouse_byte_check lifebook_6byte_checks[] = {
+	PSMOUSE_CHECK(0, 0xf8, 0x00),
+	PSMOUSE_CHECK_SAME(2, 2, 2, 0x30),
+	PSMOUSE_CHECK(3, 0xf8, 0xc0),
+	PSMOUSE_CHECK_SAME(4, 2, 0, 0xc0),
+	PSMOUSE_CHECK_SAME(5, 5, 2, 0x30),
+	PSMOUSE_CHECK_SAME(5, 1, 0, 0xc0),
+};
+
+static psmouse_ret_t lifebook_process_6byte(struct psmouse *psmouse)
+{
+	struct input_dev *dev1 = psmouse->dev;
+	unsigned char *packet = psmouse->packet;
+
+	if (packet[0] & 0x08) {
+		if (psmouse->pktcnt != 3)
+			return PSMOUSE_GOOD_DATA;
+
+		if (psmouse_repeated_packet(psmouse, packet[1] || packet[2]))
+			return PSMOUSE_FULL_PACKET;
+
+		lifebook_report_relative(psmouse, true);
+		return PSMOUSE_FULL_PACKET;
 	}
 
+	if (!psmouse_check_byte(lifebook_6byte_checks,
+				ARRAY_SIZE(lifebook_6byte_checks),
+				packet, psmouse->pktcnt - 1))
+		return PSMOUSE_BAD_DATA;
+
+	if (psmouse->pktcnt < 6)
+		return PSMOUSE_GOOD_DATA;
+
+	if (psmouse_repeated_packet(psmouse, false))
+		return PSMOUSE_FULL_PACKET;
+
+	input_report_abs(dev1, ABS_X,
+		((packet[1] & 0x3f) << 6) | (packet[2] & 0x3f));
+	input_report_abs(dev1, ABS_Y,
+		4096 - (((packet[4] & 0x3f) << 6) | (packet[5] & 0x3f)));
+	input_report_key(dev1, BTN_TOUCH, packet[0] & 0x04);
+	input_sync(dev1);
+
+	lifebook_report_relative(psmouse, false);
+
 	return PSMOUSE_FULL_PACKET;
 }
 
+static const struct lifebook_framing lifebook_3byte_framing = {
+	.process_byte	= lifebook_process_3byte,
+	.absolute_res	= 0x07,
+	.max_coord	= 1024,
+	.model		= 3,
+};
+
+static const struct lifebook_framing lifebook_6byte_framing = {
+	.process_byte	= lifebook_process_6byte,
+	.absolute_res	= 0x08,
+	.max_coord	= 4096,
+	.model		= 6,
+};
+
 static int lifebook_absolute_mode(struct psmouse *psmouse)
 {
+	struct lifebook_data *priv = psmouse->private;
 	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	unsigned char param;
 
@@ -215,7 +280,7 @@ static int lifebook_absolute_mode(struct psmouse *psmouse)
 	 * you leave this call out the touchscreen will never send
 	 * absolute coordinates
 	 */
-	param = lifebook_use_6byte_proto ? 0x08 : 0x07;
+	param = priv->framing->absolute_res;
 	ps2_command(ps2dev, &param, PSMOUSE_CMD_SETRES);
 
 	return 0;
@@ -248,7 +313,8 @@ static void lifebook_disconnect(struct psmouse *psmouse)
 
 	psmouse_reset(psmouse);
 	if (priv) {
-		input_unregister_device(priv->dev2);
+		if (priv->dev2)
+			input_unregister_device(priv->dev2);
 		kfree(priv);
 	}
 	psmouse->private = NULL;
@@ -273,16 +339,14 @@ int lifebook_detect(struct psmouse *psmouse, bool set_properties)
 
 static int lifebook_create_relative_device(struct psmouse *psmouse)
 {
+	struct lifebook_data *priv = psmouse->private;
 	struct input_dev *dev2;
-	struct lifebook_data *priv;
-	int error = -ENOMEM;
+	int error;
 
-	priv = kzalloc(sizeof(struct lifebook_data), GFP_KERNEL);
 	dev2 = input_allocate_device();
-	if (!priv || !dev2)
-		goto err_out;
+	if (!dev2)
+		return -ENOMEM;
 
-	priv->dev2 = dev2;
 	snprintf(priv->phys, sizeof(priv->phys),
 		 "%s/input1", psmouse->ps2dev.serio->phys);
 
@@ -299,47 +363,53 @@ static int lifebook_create_relative_device(struct psmouse *psmouse)
 	dev2->keybit[BIT_WORD(BTN_LEFT)] =
 				BIT_MASK(BTN_LEFT) | BIT_MASK(BTN_RIGHT);
 
-	error = input_register_device(priv->dev2);
-	if (error)
-		goto err_out;
+	error = input_register_device(dev2);
+	if (error) {
+		input_free_device(dev2);
+		return error;
+	}
 
-	psmouse->private = priv;
+	priv->dev2 = dev2;
 	return 0;
-
- err_out:
-	input_free_device(dev2);
-	kfree(priv);
-	return error;
 }
 
 int lifebook_init(struct psmouse *psmouse)
 {
 	struct input_dev *dev1 = psmouse->dev;
-	int max_coord = lifebook_use_6byte_proto ? 4096 : 1024;
+	struct lifebook_data *priv;
+
+	priv = kzalloc(sizeof(struct lifebook_data), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	/* The framing is decided once per port, not on every byte */
+	priv->framing = lifebook_use_6byte_proto ?
+			&lifebook_6byte_framing : &lifebook_3byte_framing;
+	psmouse->private = priv;
 
 	if (lifebook_absolute_mode(psmouse))
-		return -1;
+		goto err_out;
 
 	dev1->evbit[0] = BIT_MASK(EV_ABS) | BIT_MASK(EV_KEY);
 	dev1->relbit[0] = 0;
 	dev1->keybit[BIT_WORD(BTN_MOUSE)] = 0;
 	dev1->keybit[BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH);
-	input_set_abs_params(dev1, ABS_X, 0, max_coord, 0, 0);
-	input_set_abs_params(dev1, ABS_Y, 0, max_coord, 0, 0);
+	input_set_abs_params(dev1, ABS_X, 0, priv->framing->max_coord, 0, 0);
+	input_set_abs_params(dev1, ABS_Y, 0, priv->framing->max_coord, 0, 0);
 
 	if (!desired_serio_phys) {
 		if (lifebook_create_relative_device(psmouse)) {
 			lifebook_relative_mode(psmouse);
-			return -1;
+			goto err_out;
 		}
 	}
 
-	psmouse->protocol_handler = lifebook_process_byte;
+	psmouse->protocol_handler = priv->framing->process_byte;
 	psmouse->set_resolution = lifebook_set_resolution;
 	psmouse->disconnect = lifebook_disconnect;
 	psmouse->reconnect  = lifebook_absolute_mode;
 
-	psmouse->model = lifebook_use_6byte_proto ? 6 : 3;
+	psmouse->model = priv->framing->model;
 
 	/*
 	 * Use packet size = 3 even when using 6-byte protocol because
@@ -348,5 +418,9 @@ int lifebook_init(struct psmouse *psmouse)
 	psmouse->pktsize = 3;
 
 	return 0;
-}
 
+ err_out:
+	kfree(priv);
+	psmouse->private = NULL;
+	return -1;
+}
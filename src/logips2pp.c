@@ -43,6 +43,7 @@ static psmouse_ret_t ps2pp_process_byte(struct psmouse *psmouse)
 {
 	struct input_dev *dev = psmouse->dev;
 	unsigned char *packet = psmouse->packet;
+	bool ext;
 
 	if (psmouse->pktcnt < 3)
 		return PSMOUSE_GOOD_DATA;
@@ -51,14 +52,22 @@ static psmouse_ret_t ps2pp_process_byte(struct psmouse *psmouse)
  * Full packet accumulated, process it
  */
 
-	if ((packet[0] & 0x48) == 0x48 && (packet[1] & 0x02) == 0x02) {
+	ext = (packet[0] & 0x48) == 0x48 && (packet[1] & 0x02) == 0x02;
+
+	/* Extended packets may carry wheel movement, treat them as motion */
+	if (psmouse_repeated_packet(psmouse, ext || packet[1] || packet[2] ||
+					     psmouse->filter.jump_delta ||
+					     psmouse->filter.spew_count))
+		return PSMOUSE_FULL_PACKET;
+
+	if (ext) {
 
 		/* Logitech extended packet */
 		switch ((packet[1] >> 4) | (packet[0] & 0x30)) {
 
 		case 0x0d: /* Mouse extra info */
 
-			input_report_rel(dev, packet[2] & 0x80 ? REL_HWHEEL : REL_WHEEL,
+			psmouse_report_wheel(dev, packet[2] & 0x80 ? REL_HWHEEL : REL_WHEEL,
 				(int) (packet[2] & 8) - (int) (packet[2] & 7));
 			input_report_key(dev, BTN_SIDE, (packet[2] >> 4) & 1);
 			input_report_key(dev, BTN_EXTRA, (packet[2] >> 5) & 1);
@@ -77,7 +86,7 @@ static psmouse_ret_t ps2pp_process_byte(struct psmouse *psmouse)
 
 		case 0x0f: /* TouchPad extra info */
 
-			input_report_rel(dev, packet[2] & 0x08 ? REL_HWHEEL : REL_WHEEL,
+			psmouse_report_wheel(dev, packet[2] & 0x08 ? REL_HWHEEL : REL_WHEEL,
 				(int) ((packet[2] >> 4) & 8) - (int) ((packet[2] >> 4) & 7));
 			packet[0] = packet[2] | 0x08;
 			break;
@@ -90,8 +99,15 @@ static psmouse_ret_t ps2pp_process_byte(struct psmouse *psmouse)
 		}
 	} else {
 		/* Standard PS/2 motion data */
-		input_report_rel(dev, REL_X, packet[1] ? (int) packet[1] - (int) ((packet[0] << 4) & 0x100) : 0);
-		input_report_rel(dev, REL_Y, packet[2] ? (int) ((packet[0] << 3) & 0x100) - (int) packet[2] : 0);
+		int x = packet[1] ? (int) packet[1] - (int) ((packet[0] << 4) & 0x100) : 0;
+		int y = packet[2] ? (int) ((packet[0] << 3) & 0x100) - (int) packet[2] : 0;
+
+		if (psmouse_filter_motion(psmouse, x, y, packet[0] & 7) &
+		    PSMOUSE_FILTER_DISCARD)
+			x = y = 0;
+
+		input_report_rel(dev, REL_X, x);
+		input_report_rel(dev, REL_Y, y);
 	}
 
 	input_report_key(dev, BTN_LEFT,    packet[0]       & 1);
@@ -199,65 +215,97 @@ static void ps2pp_disconnect(struct psmouse *psmouse)
 	device_remove_file(&psmouse->ps2dev.serio->dev, &psmouse_attr_smartscroll.dattr);
 }
 
+/*
+ * Known models, indexed by the 7-bit model number reported by the mouse.
+ * Slots of unknown models are left zeroed, model 0 is never valid.
+ */
+#define PS2PP_MODEL(_model, _kind, _features)	\
+	[_model] = { .model = _model, .kind = _kind, .features = _features }
+
+static const struct ps2pp_info ps2pp_models[128] = {
+	PS2PP_MODEL(  1, 0,			0),	/* Simple 2-button mouse */
+	PS2PP_MODEL( 12, 0,			PS2PP_SIDE_BTN),
+	PS2PP_MODEL( 13, 0,			0),
+	PS2PP_MODEL( 15, PS2PP_KIND_MX,					/* MX1000 */
+			PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
+			PS2PP_EXTRA_BTN | PS2PP_NAV_BTN | PS2PP_HWHEEL),
+	PS2PP_MODEL( 40, 0,			PS2PP_SIDE_BTN),
+	PS2PP_MODEL( 41, 0,			PS2PP_SIDE_BTN),
+	PS2PP_MODEL( 42, 0,			PS2PP_SIDE_BTN),
+	PS2PP_MODEL( 43, 0,			PS2PP_SIDE_BTN),
+	PS2PP_MODEL( 50, 0,			0),
+	PS2PP_MODEL( 51, 0,			0),
+	PS2PP_MODEL( 52, PS2PP_KIND_WHEEL,	PS2PP_SIDE_BTN | PS2PP_WHEEL),
+	PS2PP_MODEL( 53, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 56, PS2PP_KIND_WHEEL,	PS2PP_SIDE_BTN | PS2PP_WHEEL), /* Cordless MouseMan Wheel */
+	PS2PP_MODEL( 61, PS2PP_KIND_MX,					/* MX700 */
+			PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
+			PS2PP_EXTRA_BTN | PS2PP_NAV_BTN),
+	PS2PP_MODEL( 66, PS2PP_KIND_MX,					/* MX3100 receiver */
+			PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
+			PS2PP_EXTRA_BTN | PS2PP_NAV_BTN | PS2PP_HWHEEL),
+	PS2PP_MODEL( 72, PS2PP_KIND_TRACKMAN,	0),			/* T-CH11: TrackMan Marble */
+	PS2PP_MODEL( 73, PS2PP_KIND_TRACKMAN,	PS2PP_SIDE_BTN),	/* TrackMan FX */
+	PS2PP_MODEL( 75, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 76, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 79, PS2PP_KIND_TRACKMAN,	PS2PP_WHEEL),		/* TrackMan with wheel */
+	PS2PP_MODEL( 80, PS2PP_KIND_WHEEL,	PS2PP_SIDE_BTN | PS2PP_WHEEL),
+	PS2PP_MODEL( 81, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 83, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 85, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 86, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 87, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 88, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL( 96, 0,			0),
+	PS2PP_MODEL( 97, PS2PP_KIND_TP3,	PS2PP_WHEEL | PS2PP_HWHEEL),
+	PS2PP_MODEL( 99, PS2PP_KIND_WHEEL,	PS2PP_WHEEL),
+	PS2PP_MODEL(100, PS2PP_KIND_MX,					/* MX510 */
+			PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
+			PS2PP_EXTRA_BTN | PS2PP_NAV_BTN),
+	PS2PP_MODEL(111, PS2PP_KIND_MX,	PS2PP_WHEEL | PS2PP_SIDE_BTN),	/* MX300 reports task button as side */
+	PS2PP_MODEL(112, PS2PP_KIND_MX,					/* MX500 */
+			PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
+			PS2PP_EXTRA_BTN | PS2PP_NAV_BTN),
+	PS2PP_MODEL(114, PS2PP_KIND_MX,					/* MX310 */
+			PS2PP_WHEEL | PS2PP_SIDE_BTN |
+			PS2PP_TASK_BTN | PS2PP_EXTRA_BTN),
+};
+
+#undef PS2PP_MODEL
+
 static const struct ps2pp_info *get_model_info(unsigned char model)
 {
-	static const struct ps2pp_info ps2pp_list[] = {
-		{  1,	0,			0 },	/* Simple 2-button mouse */
-		{ 12,	0,			PS2PP_SIDE_BTN},
-		{ 13,	0,			0 },
-		{ 15,	PS2PP_KIND_MX,					/* MX1000 */
-				PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
-				PS2PP_EXTRA_BTN | PS2PP_NAV_BTN | PS2PP_HWHEEL },
-		{ 40,	0,			PS2PP_SIDE_BTN },
-		{ 41,	0,			PS2PP_SIDE_BTN },
-		{ 42,	0,			PS2PP_SIDE_BTN },
-		{ 43,	0,			PS2PP_SIDE_BTN },
-		{ 50,	0,			0 },
-		{ 51,	0,			0 },
-		{ 52,	PS2PP_KIND_WHEEL,	PS2PP_SIDE_BTN | PS2PP_WHEEL },
-		{ 53,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 56,	PS2PP_KIND_WHEEL,	PS2PP_SIDE_BTN | PS2PP_WHEEL }, /* Cordless MouseMan Wheel */
-		{ 61,	PS2PP_KIND_MX,					/* MX700 */
-				PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
-				PS2PP_EXTRA_BTN | PS2PP_NAV_BTN },
-		{ 66,	PS2PP_KIND_MX,					/* MX3100 receiver */
-				PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
-				PS2PP_EXTRA_BTN | PS2PP_NAV_BTN | PS2PP_HWHEEL },
-		{ 72,	PS2PP_KIND_TRACKMAN,	0 },			/* T-CH11: TrackMan Marble */
-		{ 73,	PS2PP_KIND_TRACKMAN,	PS2PP_SIDE_BTN },	/* TrackMan FX */
-		{ 75,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 76,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 79,	PS2PP_KIND_TRACKMAN,	PS2PP_WHEEL },		/* TrackMan with wheel */
-		{ 80,	PS2PP_KIND_WHEEL,	PS2PP_SIDE_BTN | PS2PP_WHEEL },
-		{ 81,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 83,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 85,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 86,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 87,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 88,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 96,	0,			0 },
-		{ 97,	PS2PP_KIND_TP3,		PS2PP_WHEEL | PS2PP_HWHEEL },
-		{ 99,	PS2PP_KIND_WHEEL,	PS2PP_WHEEL },
-		{ 100,	PS2PP_KIND_MX,					/* MX510 */
-				PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
-				PS2PP_EXTRA_BTN | PS2PP_NAV_BTN },
-		{ 111,  PS2PP_KIND_MX,	PS2PP_WHEEL | PS2PP_SIDE_BTN },	/* MX300 reports task button as side */
-		{ 112,	PS2PP_KIND_MX,					/* MX500 */
-				PS2PP_WHEEL | PS2PP_SIDE_BTN | PS2PP_TASK_BTN |
-				PS2PP_EXTRA_BTN | PS2PP_NAV_BTN },
-		{ 114,	PS2PP_KIND_MX,					/* MX310 */
-				PS2PP_WHEEL | PS2PP_SIDE_BTN |
-				PS2PP_TASK_BTN | PS2PP_EXTRA_BTN }
-	};
-	int i;
+	const struct ps2pp_info *info;
 
-	for (i = 0; i < ARRAY_SIZE(ps2pp_list); i++)
-		if (model == ps2pp_list[i].model)
-			return &ps2pp_list[i];
+	if (model >= ARRAY_SIZE(ps2pp_models))
+		return NULL;
 
-	return NULL;
+	info = &ps2pp_models[model];
+	return info->model ? info : NULL;
 }
 
+/*
+ * Input capabilities implied by each feature bit.
+ */
+static const struct {
+	u16 feature;
+	u8 type;
+	u16 code;
+} ps2pp_feature_map[] = {
+	{ PS2PP_SIDE_BTN,	EV_KEY,	BTN_SIDE },
+	{ PS2PP_EXTRA_BTN,	EV_KEY,	BTN_EXTRA },
+	{ PS2PP_TASK_BTN,	EV_KEY,	BTN_TASK },
+	{ PS2PP_NAV_BTN,	EV_KEY,	BTN_FORWARD },
+	{ PS2PP_NAV_BTN,	EV_KEY,	BTN_BACK },
+};
+
+static char * const ps2pp_kind_names[] = {
+	[PS2PP_KIND_WHEEL]	= "Wheel Mouse",
+	[PS2PP_KIND_MX]		= "MX Mouse",
+	[PS2PP_KIND_TP3]	= "TouchPad 3",
+	[PS2PP_KIND_TRACKMAN]	= "TrackMan",
+};
+
 /*
  * Set up input device's properties based on the detected mouse model.
  */
@@ -267,55 +315,29 @@ static void ps2pp_set_model_properties(struct psmouse *psmouse,
 				       bool using_ps2pp)
 {
 	struct input_dev *input_dev = psmouse->dev;
+	int i;
 
-	if (model_info->features & PS2PP_SIDE_BTN)
-		__set_bit(BTN_SIDE, input_dev->keybit);
-
-	if (model_info->features & PS2PP_EXTRA_BTN)
-		__set_bit(BTN_EXTRA, input_dev->keybit);
-
-	if (model_info->features & PS2PP_TASK_BTN)
-		__set_bit(BTN_TASK, input_dev->keybit);
-
-	if (model_info->features & PS2PP_NAV_BTN) {
-		__set_bit(BTN_FORWARD, input_dev->keybit);
-		__set_bit(BTN_BACK, input_dev->keybit);
-	}
+	for (i = 0; i < ARRAY_SIZE(ps2pp_feature_map); i++)
+		if (model_info->features & ps2pp_feature_map[i].feature)
+			input_set_capability(input_dev,
+					     ps2pp_feature_map[i].type,
+					     ps2pp_feature_map[i].code);
 
 	if (model_info->features & PS2PP_WHEEL)
-		__set_bit(REL_WHEEL, input_dev->relbit);
+		psmouse_set_wheel(input_dev, REL_WHEEL);
 
 	if (model_info->features & PS2PP_HWHEEL)
-		__set_bit(REL_HWHEEL, input_dev->relbit);
+		psmouse_set_wheel(input_dev, REL_HWHEEL);
 
-	switch (model_info->kind) {
-
-	case PS2PP_KIND_WHEEL:
-		psmouse->name = "Wheel Mouse";
-		break;
-
-	case PS2PP_KIND_MX:
-		psmouse->name = "MX Mouse";
-		break;
-
-	case PS2PP_KIND_TP3:
-		psmouse->name = "TouchPad 3";
-		break;
-
-	case PS2PP_KIND_TRACKMAN:
-		psmouse->name = "TrackMan";
-		break;
-
-	default:
+	if (model_info->kind && model_info->kind < ARRAY_SIZE(ps2pp_kind_names))
+		psmouse->name = ps2pp_kind_names[model_info->kind];
+	else if (using_ps2pp)
 		/*
 		 * Set name to "Mouse" only when using PS2++,
 		 * otherwise let other protocols define suitable
 		 * name
 		 */
-		if (using_ps2pp)
-			psmouse->name = "Mouse";
-		break;
-	}
+		psmouse->name = "Mouse";
 }
 
 
@@ -14,6 +14,7 @@
 #define pr_fmt(fmt)		KBUILD_MODNAME ": " fmt
 #define psmouse_fmt(fmt)	fmt
 
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/slab.h>
@@ -23,6 +24,8 @@
 #include <linux/init.h>
 #include <linux/libps2.h>
 #include <linux/mutex.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 
 #include "psmouse.h"
 #include "synaptics.h"
@@ -74,6 +77,14 @@ static unsigned int psmouse_resync_time;
 module_param_named(resync_time, psmouse_resync_time, uint, 0644);
 MODULE_PARM_DESC(resync_time, "How long can mouse stay idle before forcing resync (in seconds, 0 = never).");
 
+static unsigned int psmouse_sync_timeout = 500;
+module_param_named(sync_timeout, psmouse_sync_timeout, uint, 0644);
+MODULE_PARM_DESC(sync_timeout, "How long can a packet stay incomplete before its bytes are thrown away (in milliseconds, 0 = never).");
+
+static bool psmouse_sync_dedup = 1;
+module_param_named(sync_dedup, psmouse_sync_dedup, bool, 0644);
+MODULE_PARM_DESC(sync_dedup, "Drop repeated packets carrying no motion, 1 = enabled (default), 0 = disabled.");
+
 PSMOUSE_DEFINE_ATTR(protocol, S_IWUSR | S_IRUGO,
 			NULL,
 			psmouse_attr_show_protocol, psmouse_attr_set_protocol);
@@ -89,6 +100,20 @@ PSMOUSE_DEFINE_ATTR(resetafter, S_IWUSR | S_IRUGO,
 PSMOUSE_DEFINE_ATTR(resync_time, S_IWUSR | S_IRUGO,
 			(void *) offsetof(struct psmouse, resync_time),
 			psmouse_show_int_attr, psmouse_set_int_attr);
+PSMOUSE_DEFINE_ATTR(sync_timeout, S_IWUSR | S_IRUGO,
+			(void *) offsetof(struct psmouse, sync_timeout),
+			psmouse_show_int_attr, psmouse_set_int_attr);
+PSMOUSE_DEFINE_ATTR(filter_jump_delta, S_IWUSR | S_IRUGO,
+			(void *) offsetof(struct psmouse, filter.jump_delta),
+			psmouse_show_int_attr, psmouse_set_int_attr);
+PSMOUSE_DEFINE_ATTR(filter_spew_count, S_IWUSR | S_IRUGO,
+			(void *) offsetof(struct psmouse, filter.spew_count),
+			psmouse_show_int_attr, psmouse_set_int_attr);
+PSMOUSE_DEFINE_ATTR(sync_dedup, S_IWUSR | S_IRUGO,
+			NULL,
+			psmouse_attr_show_sync_dedup, psmouse_attr_set_sync_dedup);
+PSMOUSE_DEFINE_RO_ATTR(sync_stats, S_IRUGO, NULL, psmouse_attr_show_sync_stats);
+PSMOUSE_DEFINE_RO_ATTR(error_stats, S_IRUGO, NULL, psmouse_attr_show_error_stats);
 
 static struct attribute *psmouse_attributes[] = {
 	&psmouse_attr_protocol.dattr.attr,
@@ -96,6 +121,12 @@ static struct attribute *psmouse_attributes[] = {
 	&psmouse_attr_resolution.dattr.attr,
 	&psmouse_attr_resetafter.dattr.attr,
 	&psmouse_attr_resync_time.dattr.attr,
+	&psmouse_attr_sync_timeout.dattr.attr,
+	&psmouse_attr_filter_jump_delta.dattr.attr,
+	&psmouse_attr_filter_spew_count.dattr.attr,
+	&psmouse_attr_sync_dedup.dattr.attr,
+	&psmouse_attr_sync_stats.dattr.attr,
+	&psmouse_attr_error_stats.dattr.attr,
 	NULL
 };
 
@@ -124,6 +155,250 @@ struct psmouse_protocol {
 	int (*init)(struct psmouse *);
 };
 
+/*
+ * psmouse_set_wheel() declares a scroll wheel axis, together with its
+ * high-resolution counterpart where the kernel knows about it.
+ */
+void psmouse_set_wheel(struct input_dev *dev, unsigned int code)
+{
+	__set_bit(code, dev->relbit);
+#ifdef REL_WHEEL_HI_RES
+	__set_bit(code == REL_HWHEEL ? REL_HWHEEL_HI_RES : REL_WHEEL_HI_RES,
+		  dev->relbit);
+#endif
+}
+
+/*
+ * psmouse_report_wheel() reports wheel movement counted in detents. None
+ * of the PS/2 wheels report anything finer, so the high-resolution axis
+ * carries the same movement in the 1/120 detent units userspace expects.
+ */
+void psmouse_report_wheel(struct input_dev *dev, unsigned int code, int detents)
+{
+	if (!detents)
+		return;
+
+	input_report_rel(dev, code, detents);
+#ifdef REL_WHEEL_HI_RES
+	input_report_rel(dev,
+			 code == REL_HWHEEL ? REL_HWHEEL_HI_RES : REL_WHEEL_HI_RES,
+			 detents * 120);
+#endif
+}
+
+/*
+ * psmouse_check_byte() validates the byte at position pos of a packet
+ * against the checks applying to that position. The checks must be
+ * sorted by position; references may only point at bytes already
+ * received.
+ */
+bool psmouse_check_byte(const struct psmouse_byte_check *checks,
+			unsigned int count, const unsigned char *packet,
+			unsigned int pos)
+{
+	const struct psmouse_byte_check *check;
+	unsigned char ref;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		check = &checks[i];
+
+		if (check->pos < pos)
+			continue;
+
+		if (check->pos > pos)
+			break;
+
+		ref = check->ref == PSMOUSE_CHECK_NO_REF ?
+			0 : packet[check->ref] >> check->shift;
+
+		if (((packet[pos] ^ ref) & check->mask) != check->expect)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * psmouse_trace_begin() claims the next slot of the trace ring and fills
+ * it with the packet received so far, or returns NULL when tracing is
+ * off. The interrupt handler is the only writer, serialized by the serio
+ * lock. Callers may add decoder state to the record before publishing it
+ * with psmouse_trace_commit(); readers only look at published entries and
+ * may see one being overwritten if they fall a full ring behind.
+ */
+struct psmouse_trace_record *psmouse_trace_begin(struct psmouse_trace *trace,
+						  unsigned char type)
+{
+	struct psmouse *psmouse = trace->psmouse;
+	struct psmouse_trace_record *rec;
+
+	if (!ACCESS_ONCE(trace->enabled))
+		return NULL;
+
+	rec = &trace->ring[trace->head & (PSMOUSE_TRACE_SIZE - 1)];
+	rec->time_ns = ktime_to_ns(ktime_get());
+	rec->type = type;
+	rec->len = min_t(unsigned char, psmouse->pktcnt, sizeof(rec->packet));
+	memcpy(rec->packet, psmouse->packet, rec->len);
+	memset(rec->aux, 0, sizeof(rec->aux));
+
+	return rec;
+}
+
+void psmouse_trace_commit(struct psmouse_trace *trace)
+{
+	smp_store_release(&trace->head, trace->head + 1);
+}
+
+/*
+ * Dump the trace ring, oldest packet first, one packet per line:
+ *
+ *	<seconds>.<nanoseconds> <packet type> <raw bytes in hex> [<aux>...]
+ */
+static int psmouse_trace_show(struct seq_file *s, void *unused)
+{
+	struct psmouse_trace *trace = s->private;
+	const struct psmouse_trace_format *format = trace->format;
+	const struct psmouse_trace_record *rec;
+	unsigned int head = smp_load_acquire(&trace->head);
+	unsigned int i, j;
+	const char *name;
+	u64 secs;
+	u32 nsecs;
+
+	if (format->show_header)
+		format->show_header(s, trace->psmouse);
+
+	i = head > PSMOUSE_TRACE_SIZE ? head - PSMOUSE_TRACE_SIZE : 0;
+	for (; i != head; i++) {
+		rec = &trace->ring[i & (PSMOUSE_TRACE_SIZE - 1)];
+
+		secs = rec->time_ns;
+		nsecs = do_div(secs, NSEC_PER_SEC);
+
+		name = rec->type < format->num_types &&
+		       format->type_names[rec->type] ?
+				format->type_names[rec->type] : "?";
+
+		seq_printf(s, "%llu.%09u %s %*ph",
+			   (unsigned long long)secs, nsecs, name,
+			   rec->len, rec->packet);
+		for (j = 0; j < format->num_aux; j++)
+			seq_printf(s, " %u", rec->aux[j]);
+		seq_putc(s, '\n');
+	}
+
+	return 0;
+}
+
+static int psmouse_trace_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, psmouse_trace_show, inode->i_private);
+}
+
+static const struct file_operations psmouse_trace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= psmouse_trace_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * psmouse_trace_init() creates the "<name>-<serio>" debugfs directory
+ * holding the trace ring ("packets") and its switch ("enabled"). Tracing
+ * starts off. Protocols may add their own files to trace->dir, which is
+ * NULL if debugfs is unavailable.
+ */
+void psmouse_trace_init(struct psmouse_trace *trace, struct psmouse *psmouse,
+			const struct psmouse_trace_format *format)
+{
+	char name[32];
+
+	trace->psmouse = psmouse;
+	trace->format = format;
+
+	snprintf(name, sizeof(name), "%s-%s",
+		 format->name, dev_name(&psmouse->ps2dev.serio->dev));
+
+	trace->dir = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(trace->dir)) {
+		trace->dir = NULL;
+		return;
+	}
+
+	debugfs_create_bool("enabled", S_IWUSR | S_IRUGO, trace->dir,
+			    &trace->enabled);
+	debugfs_create_file("packets", S_IRUSR, trace->dir, trace,
+			    &psmouse_trace_fops);
+}
+
+void psmouse_trace_cleanup(struct psmouse_trace *trace)
+{
+	debugfs_remove_recursive(trace->dir);
+	trace->dir = NULL;
+}
+
+/*
+ * psmouse_repeated_packet() is called by decoders with each complete
+ * packet, before anything is reported. It returns true when the packet
+ * is a copy of the last one reported and carries no relative motion: all
+ * it would report are button and absolute values the device already has.
+ * The input core would discard each of those events and the sync that
+ * follows, but only after taking the device's event lock for every one of
+ * them, which on idle-jitter devices happens at the full packet rate.
+ * Packets with motion are never dropped but still update the cache, as
+ * does any state change of the device (see __psmouse_set_state()).
+ */
+bool psmouse_repeated_packet(struct psmouse *psmouse, bool motion)
+{
+	unsigned int len = psmouse->pktcnt;
+
+	if (!motion && psmouse->sync_dedup && psmouse->last_packet_valid &&
+	    !memcmp(psmouse->last_packet, psmouse->packet, len)) {
+		psmouse->frames_suppressed++;
+		return true;
+	}
+
+	memcpy(psmouse->last_packet, psmouse->packet, len);
+	psmouse->last_packet_valid = true;
+	psmouse->frames_synced++;
+
+	return false;
+}
+
+/*
+ * Whether a standard PS/2, IntelliMouse or Explorer packet moves anything.
+ * Packets are also treated as moving while the motion filter is in use,
+ * since it needs to see every packet.
+ */
+static bool psmouse_packet_has_motion(struct psmouse *psmouse)
+{
+	unsigned char *packet = psmouse->packet;
+
+	if (packet[1] || packet[2] ||
+	    psmouse->filter.jump_delta || psmouse->filter.spew_count)
+		return true;
+
+	switch (psmouse->type) {
+	case PSMOUSE_IMPS:
+	case PSMOUSE_GENPS:
+		return packet[3];
+
+	case PSMOUSE_IMEX:
+		if ((packet[3] & 0xC0) == 0x80 || (packet[3] & 0xC0) == 0x40)
+			return packet[3] & 0x3f;
+		return packet[3] & 0x0f;
+
+	case PSMOUSE_THINKPS:
+		return packet[0] & 0x40;
+
+	default:
+		return false;
+	}
+}
+
 /*
  * psmouse_process_byte() analyzes the PS/2 data stream and reports
  * relevant events to the input module once full packet has arrived.
@@ -133,6 +408,7 @@ psmouse_ret_t psmouse_process_byte(struct psmouse *psmouse)
 {
 	struct input_dev *dev = psmouse->dev;
 	unsigned char *packet = psmouse->packet;
+	int x, y;
 
 	if (psmouse->pktcnt < psmouse->pktsize)
 		return PSMOUSE_GOOD_DATA;
@@ -141,12 +417,15 @@ psmouse_ret_t psmouse_process_byte(struct psmouse *psmouse)
  * Full packet accumulated, process it
  */
 
+	if (psmouse_repeated_packet(psmouse, psmouse_packet_has_motion(psmouse)))
+		return PSMOUSE_FULL_PACKET;
+
 /*
  * Scroll wheel on IntelliMice, scroll buttons on NetMice
  */
 
 	if (psmouse->type == PSMOUSE_IMPS || psmouse->type == PSMOUSE_GENPS)
-		input_report_rel(dev, REL_WHEEL, -(signed char) packet[3]);
+		psmouse_report_wheel(dev, REL_WHEEL, -(signed char) packet[3]);
 
 /*
  * Scroll wheel and buttons on IntelliMouse Explorer
@@ -155,14 +434,14 @@ psmouse_ret_t psmouse_process_byte(struct psmouse *psmouse)
 	if (psmouse->type == PSMOUSE_IMEX) {
 		switch (packet[3] & 0xC0) {
 		case 0x80: /* vertical scroll on IntelliMouse Explorer 4.0 */
-			input_report_rel(dev, REL_WHEEL, (int) (packet[3] & 32) - (int) (packet[3] & 31));
+			psmouse_report_wheel(dev, REL_WHEEL, (int) (packet[3] & 32) - (int) (packet[3] & 31));
 			break;
 		case 0x40: /* horizontal scroll on IntelliMouse Explorer 4.0 */
-			input_report_rel(dev, REL_HWHEEL, (int) (packet[3] & 32) - (int) (packet[3] & 31));
+			psmouse_report_wheel(dev, REL_HWHEEL, (int) (packet[3] & 32) - (int) (packet[3] & 31));
 			break;
 		case 0x00:
 		case 0xC0:
-			input_report_rel(dev, REL_WHEEL, (int) (packet[3] & 8) - (int) (packet[3] & 7));
+			psmouse_report_wheel(dev, REL_WHEEL, (int) (packet[3] & 8) - (int) (packet[3] & 7));
 			input_report_key(dev, BTN_SIDE, (packet[3] >> 4) & 1);
 			input_report_key(dev, BTN_EXTRA, (packet[3] >> 5) & 1);
 			break;
@@ -204,8 +483,15 @@ psmouse_ret_t psmouse_process_byte(struct psmouse *psmouse)
 	input_report_key(dev, BTN_MIDDLE, (packet[0] >> 2) & 1);
 	input_report_key(dev, BTN_RIGHT,  (packet[0] >> 1) & 1);
 
-	input_report_rel(dev, REL_X, packet[1] ? (int) packet[1] - (int) ((packet[0] << 4) & 0x100) : 0);
-	input_report_rel(dev, REL_Y, packet[2] ? (int) ((packet[0] << 3) & 0x100) - (int) packet[2] : 0);
+	x = packet[1] ? (int) packet[1] - (int) ((packet[0] << 4) & 0x100) : 0;
+	y = packet[2] ? (int) ((packet[0] << 3) & 0x100) - (int) packet[2] : 0;
+
+	if (psmouse_filter_motion(psmouse, x, y, packet[0] & 7) &
+	    PSMOUSE_FILTER_DISCARD)
+		x = y = 0;
+
+	input_report_rel(dev, REL_X, x);
+	input_report_rel(dev, REL_Y, y);
 
 	input_sync(dev);
 
@@ -227,7 +513,8 @@ static inline void __psmouse_set_state(struct psmouse *psmouse, enum psmouse_sta
 	psmouse->state = new_state;
 	psmouse->pktcnt = psmouse->out_of_sync_cnt = 0;
 	psmouse->ps2dev.flags = 0;
-	psmouse->last = jiffies;
+	psmouse->last = ktime_get();
+	psmouse->last_packet_valid = false;
 }
 
 
@@ -244,6 +531,54 @@ void psmouse_set_state(struct psmouse *psmouse, enum psmouse_state new_state)
 	serio_continue_rx(psmouse->ps2dev.serio);
 }
 
+/*
+ * Transport errors are only counted in interrupt context; a summary is
+ * logged from the workqueue at most once per PSMOUSE_STATS_INTERVAL so
+ * that a flaky device does not flood the log under the serio lock.
+ */
+#define PSMOUSE_STATS_INTERVAL	(5 * HZ)
+
+static void psmouse_stats_event(struct psmouse *psmouse)
+{
+	psmouse_queue_work(psmouse, &psmouse->stats_work,
+			   PSMOUSE_STATS_INTERVAL);
+}
+
+static void psmouse_stats_work(struct work_struct *work)
+{
+	struct psmouse *psmouse =
+		container_of(work, struct psmouse, stats_work.work);
+	struct psmouse_stats *last = &psmouse->stats_reported;
+	struct psmouse_stats now;
+	unsigned long lost_sync = 0;
+	unsigned long parity_errors, timeouts;
+	int i;
+
+	serio_pause_rx(psmouse->ps2dev.serio);
+	now = psmouse->stats;
+	serio_continue_rx(psmouse->ps2dev.serio);
+
+	for (i = 0; i < ARRAY_SIZE(now.lost_sync); i++)
+		lost_sync += now.lost_sync[i] - last->lost_sync[i];
+
+	parity_errors = now.parity_errors - last->parity_errors;
+	timeouts = now.timeouts - last->timeouts;
+
+	/*
+	 * Stale packets and resyncs alone are routine, e.g. after the
+	 * device was idle, and are not worth a warning.
+	 */
+	psmouse_printk(lost_sync || parity_errors || timeouts ?
+			KERN_WARNING : KERN_NOTICE, psmouse,
+		       "%s at %s: lost sync %lu times, %lu stale packets, %lu parity errors, %lu timeouts, %lu resyncs since last report\n",
+		       psmouse->name, psmouse->phys, lost_sync,
+		       now.stale_packets - last->stale_packets,
+		       parity_errors, timeouts,
+		       now.resyncs - last->resyncs);
+
+	*last = now;
+}
+
 /*
  * psmouse_handle_byte() processes one byte of the input data stream
  * by calling corresponding protocol handler.
@@ -256,10 +591,8 @@ static int psmouse_handle_byte(struct psmouse *psmouse)
 	switch (rc) {
 	case PSMOUSE_BAD_DATA:
 		if (psmouse->state == PSMOUSE_ACTIVATED) {
-			psmouse_warn(psmouse,
-				     "%s at %s lost sync at byte %d\n",
-				     psmouse->name, psmouse->phys,
-				     psmouse->pktcnt);
+			psmouse->stats.lost_sync[psmouse->pktcnt - 1]++;
+			psmouse_stats_event(psmouse);
 			if (++psmouse->out_of_sync_cnt == psmouse->resetafter) {
 				__psmouse_set_state(psmouse, PSMOUSE_IGNORE);
 				psmouse_notice(psmouse,
@@ -275,9 +608,8 @@ static int psmouse_handle_byte(struct psmouse *psmouse)
 		psmouse->pktcnt = 0;
 		if (psmouse->out_of_sync_cnt) {
 			psmouse->out_of_sync_cnt = 0;
-			psmouse_notice(psmouse,
-					"%s at %s - driver resynced.\n",
-					psmouse->name, psmouse->phys);
+			psmouse->stats.resyncs++;
+			psmouse_stats_event(psmouse);
 		}
 		break;
 
@@ -290,12 +622,20 @@ static int psmouse_handle_byte(struct psmouse *psmouse)
 /*
  * psmouse_interrupt() handles incoming characters, either passing them
  * for normal processing or gathering them as command response.
+ *
+ * Bytes are timestamped with the monotonic clock: a packet left incomplete
+ * for more than sync_timeout milliseconds is thrown away, and a device
+ * idle for more than resync_time seconds is resynchronized before its
+ * next packet (either check is off when set to 0). The arrival times of the current and previous packet are
+ * kept in packet_time and prev_packet_time for protocols that look at
+ * inter-packet gaps.
  */
 
 static irqreturn_t psmouse_interrupt(struct serio *serio,
 		unsigned char data, unsigned int flags)
 {
 	struct psmouse *psmouse = serio_get_drvdata(serio);
+	ktime_t now;
 
 	if (psmouse->state == PSMOUSE_IGNORE)
 		goto out;
@@ -303,11 +643,13 @@ static irqreturn_t psmouse_interrupt(struct serio *serio,
 	if (unlikely((flags & SERIO_TIMEOUT) ||
 		     ((flags & SERIO_PARITY) && !psmouse->ignore_parity))) {
 
-		if (psmouse->state == PSMOUSE_ACTIVATED)
-			psmouse_warn(psmouse,
-				     "bad data from KBC -%s%s\n",
-				     flags & SERIO_TIMEOUT ? " timeout" : "",
-				     flags & SERIO_PARITY ? " bad parity" : "");
+		if (psmouse->state == PSMOUSE_ACTIVATED) {
+			if (flags & SERIO_TIMEOUT)
+				psmouse->stats.timeouts++;
+			if (flags & SERIO_PARITY)
+				psmouse->stats.parity_errors++;
+			psmouse_stats_event(psmouse);
+		}
 		ps2_cmd_aborted(&psmouse->ps2dev);
 		goto out;
 	}
@@ -323,10 +665,13 @@ static irqreturn_t psmouse_interrupt(struct serio *serio,
 	if (psmouse->state <= PSMOUSE_RESYNCING)
 		goto out;
 
-	if (psmouse->state == PSMOUSE_ACTIVATED &&
-	    psmouse->pktcnt && time_after(jiffies, psmouse->last + HZ/2)) {
-		psmouse_info(psmouse, "%s at %s lost synchronization, throwing %d bytes away.\n",
-			     psmouse->name, psmouse->phys, psmouse->pktcnt);
+	now = ktime_get();
+
+	if (psmouse->state == PSMOUSE_ACTIVATED && psmouse->pktcnt &&
+	    psmouse->sync_timeout &&
+	    ktime_to_ms(ktime_sub(now, psmouse->last)) > psmouse->sync_timeout) {
+		psmouse->stats.stale_packets++;
+		psmouse_stats_event(psmouse);
 		psmouse->badbyte = psmouse->packet[0];
 		__psmouse_set_state(psmouse, PSMOUSE_RESYNCING);
 		psmouse_queue_work(psmouse, &psmouse->resync_work, 0);
@@ -334,12 +679,16 @@ static irqreturn_t psmouse_interrupt(struct serio *serio,
 	}
 
 	psmouse->packet[psmouse->pktcnt++] = data;
+	if (psmouse->pktcnt == 1) {
+		psmouse->prev_packet_time = psmouse->packet_time;
+		psmouse->packet_time = now;
+	}
 /*
  * Check if this is a new device announcement (0xAA 0x00)
  */
 	if (unlikely(psmouse->packet[0] == PSMOUSE_RET_BAT && psmouse->pktcnt <= 2)) {
 		if (psmouse->pktcnt == 1) {
-			psmouse->last = jiffies;
+			psmouse->last = now;
 			goto out;
 		}
 
@@ -365,20 +714,68 @@ static irqreturn_t psmouse_interrupt(struct serio *serio,
  */
 	if (psmouse->state == PSMOUSE_ACTIVATED &&
 	    psmouse->pktcnt == 1 && psmouse->resync_time &&
-	    time_after(jiffies, psmouse->last + psmouse->resync_time * HZ)) {
+	    ktime_to_ms(ktime_sub(now, psmouse->last)) >
+			(s64)psmouse->resync_time * MSEC_PER_SEC) {
 		psmouse->badbyte = psmouse->packet[0];
 		__psmouse_set_state(psmouse, PSMOUSE_RESYNCING);
 		psmouse_queue_work(psmouse, &psmouse->resync_work, 0);
 		goto out;
 	}
 
-	psmouse->last = jiffies;
+	psmouse->last = now;
 	psmouse_handle_byte(psmouse);
 
  out:
 	return IRQ_HANDLED;
 }
 
+static struct serio_driver psmouse_drv;
+
+/*
+ * psmouse_pass_packet() hands a complete packet received by a parent
+ * device (such as a touchpad with a pass-through port) straight to the
+ * protocol handler of the device on the child port, bypassing per-byte
+ * delivery through serio_interrupt() and psmouse_interrupt(). The first
+ * pktsize bytes of the buffer are used. Returns false if the child is
+ * not ready to take a whole packet, in which case the caller should
+ * fall back to passing the data byte by byte.
+ */
+bool psmouse_pass_packet(struct serio *serio,
+			 const unsigned char *packet, unsigned int len)
+{
+	struct psmouse *psmouse;
+	unsigned long flags;
+	bool handled = false;
+	int i;
+
+	spin_lock_irqsave(&serio->lock, flags);
+
+	if (serio->drv != &psmouse_drv)
+		goto out;
+
+	psmouse = serio_get_drvdata(serio);
+	if (!psmouse || psmouse->state != PSMOUSE_ACTIVATED ||
+	    psmouse->ps2dev.flags || psmouse->pktcnt ||
+	    psmouse->pktsize > len)
+		goto out;
+
+	psmouse->prev_packet_time = psmouse->packet_time;
+	psmouse->packet_time = ktime_get();
+
+	for (i = 0; i < psmouse->pktsize; i++) {
+		psmouse->packet[psmouse->pktcnt++] = packet[i];
+		if (psmouse_handle_byte(psmouse))
+			break;
+	}
+
+	psmouse->last = psmouse->packet_time;
+	handled = true;
+
+ out:
+	spin_unlock_irqrestore(&serio->lock, flags);
+	return handled;
+}
+
 
 /*
  * psmouse_sliced_command() sends an extended PS/2 command to the mouse
@@ -500,7 +897,7 @@ static int genius_detect(struct psmouse *psmouse, bool set_properties)
 		__set_bit(BTN_MIDDLE, psmouse->dev->keybit);
 		__set_bit(BTN_EXTRA, psmouse->dev->keybit);
 		__set_bit(BTN_SIDE, psmouse->dev->keybit);
-		__set_bit(REL_WHEEL, psmouse->dev->relbit);
+		psmouse_set_wheel(psmouse->dev, REL_WHEEL);
 
 		psmouse->vendor = "Genius";
 		psmouse->name = "Mouse";
@@ -531,7 +928,7 @@ static int intellimouse_detect(struct psmouse *psmouse, bool set_properties)
 
 	if (set_properties) {
 		__set_bit(BTN_MIDDLE, psmouse->dev->keybit);
-		__set_bit(REL_WHEEL, psmouse->dev->relbit);
+		psmouse_set_wheel(psmouse->dev, REL_WHEEL);
 
 		if (!psmouse->vendor)
 			psmouse->vendor = "Generic";
@@ -574,8 +971,8 @@ static int im_explorer_detect(struct psmouse *psmouse, bool set_properties)
 
 	if (set_properties) {
 		__set_bit(BTN_MIDDLE, psmouse->dev->keybit);
-		__set_bit(REL_WHEEL, psmouse->dev->relbit);
-		__set_bit(REL_HWHEEL, psmouse->dev->relbit);
+		psmouse_set_wheel(psmouse->dev, REL_WHEEL);
+		psmouse_set_wheel(psmouse->dev, REL_HWHEEL);
 		__set_bit(BTN_SIDE, psmouse->dev->keybit);
 		__set_bit(BTN_EXTRA, psmouse->dev->keybit);
 
@@ -695,6 +1092,10 @@ static void psmouse_apply_defaults(struct psmouse *psmouse)
 	psmouse->cleanup = NULL;
 	psmouse->pt_activate = NULL;
 	psmouse->pt_deactivate = NULL;
+
+	psmouse->filter.jump_delta = 0;
+	psmouse->filter.spew_count = 0;
+	psmouse_filter_reset(&psmouse->filter);
 }
 
 /*
@@ -1361,6 +1762,7 @@ static void psmouse_disconnect(struct serio *serio)
 	/* make sure we don't have a resync in progress */
 	mutex_unlock(&psmouse_mutex);
 	flush_workqueue(kpsmoused_wq);
+	cancel_delayed_work_sync(&psmouse->stats_work);
 	mutex_lock(&psmouse_mutex);
 
 	if (serio->parent && serio->id.type == SERIO_PS_PSTHRU) {
@@ -1472,6 +1874,7 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
 
 	ps2_init(&psmouse->ps2dev, serio);
 	INIT_DELAYED_WORK(&psmouse->resync_work, psmouse_resync);
+	INIT_DELAYED_WORK(&psmouse->stats_work, psmouse_stats_work);
 	psmouse->dev = input_dev;
 	snprintf(psmouse->phys, sizeof(psmouse->phys), "%s/input0", serio->phys);
 
@@ -1492,7 +1895,9 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
 	psmouse->resolution = psmouse_resolution;
 	psmouse->resetafter = psmouse_resetafter;
 	psmouse->resync_time = parent ? 0 : psmouse_resync_time;
+	psmouse->sync_timeout = psmouse_sync_timeout;
 	psmouse->smartscroll = psmouse_smartscroll;
+	psmouse->sync_dedup = psmouse_sync_dedup;
 
 	psmouse_switch_protocol(psmouse, NULL);
 
@@ -1711,6 +2116,54 @@ static ssize_t psmouse_set_int_attr(struct psmouse *psmouse, void *offset, const
 	return count;
 }
 
+static ssize_t psmouse_attr_show_sync_dedup(struct psmouse *psmouse, void *data, char *buf)
+{
+	return sprintf(buf, "%d\n", psmouse->sync_dedup);
+}
+
+static ssize_t psmouse_attr_set_sync_dedup(struct psmouse *psmouse, void *data, const char *buf, size_t count)
+{
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 10, &value);
+	if (err)
+		return err;
+
+	if (value > 1)
+		return -EINVAL;
+
+	psmouse->sync_dedup = value;
+	return count;
+}
+
+static ssize_t psmouse_attr_show_sync_stats(struct psmouse *psmouse, void *data, char *buf)
+{
+	return sprintf(buf, "%lu %lu\n",
+		       psmouse->frames_synced, psmouse->frames_suppressed);
+}
+
+static ssize_t psmouse_attr_show_error_stats(struct psmouse *psmouse, void *data, char *buf)
+{
+	struct psmouse_stats stats;
+	int i, len;
+
+	serio_pause_rx(psmouse->ps2dev.serio);
+	stats = psmouse->stats;
+	serio_continue_rx(psmouse->ps2dev.serio);
+
+	len = sprintf(buf, "lost_sync");
+	for (i = 0; i < ARRAY_SIZE(stats.lost_sync); i++)
+		len += sprintf(buf + len, " %lu", stats.lost_sync[i]);
+
+	len += sprintf(buf + len,
+		       "\nstale_packets %lu\nparity_errors %lu\ntimeouts %lu\nresyncs %lu\n",
+		       stats.stale_packets, stats.parity_errors,
+		       stats.timeouts, stats.resyncs);
+
+	return len;
+}
+
 static ssize_t psmouse_attr_show_protocol(struct psmouse *psmouse, void *data, char *buf)
 {
 	return sprintf(buf, "%s\n", psmouse_protocol_by_type(psmouse->type)->name);
@@ -0,0 +1,213 @@
+/*
+ * Motion filter for relative PS/2 packets
+ *
+ * Copyright (c) 2006-2008 One Laptop Per Child
+ * Authors:
+ *   Zephaniah E. Hull
+ *   Andres Salomon <dilinger@debian.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Some pointing devices emit errant packets: oddly large deltas that the
+ * firmware then averages out over the following packets, or a steady
+ * stream of tiny deltas while nothing touches the pad. The filter below
+ * was written for the OLPC HGPK touchpad and is available to any
+ * protocol reporting relative motion. It is configured per device
+ * through psmouse->filter; a zero jump_delta and spew_count leave it
+ * disabled.
+ */
+
+#include <linux/kernel.h>
+#include <linux/input.h>
+#include <linux/serio.h>
+#include <linux/libps2.h>
+
+#include "psmouse.h"
+
+/*
+ * see if new value is within 20% of half of old value
+ */
+static int approx_half(int curr, int prev)
+{
+	int belowhalf, abovehalf;
+
+	if (curr < 5 || prev < 5)
+		return 0;
+
+	belowhalf = (prev * 8) / 20;
+	abovehalf = (prev * 12) / 20;
+
+	return belowhalf < curr && curr <= abovehalf;
+}
+
+static void psmouse_filter_reset_spew(struct psmouse_filter *filter)
+{
+	filter->spew_packets = 0;
+	filter->x_tally = 0;
+	filter->y_tally = 0;
+	filter->spew_state = PSMOUSE_NO_SPEW;
+}
+
+void psmouse_filter_reset(struct psmouse_filter *filter)
+{
+	filter->xlast = filter->ylast = INT_MAX;
+	filter->xbigj = filter->ybigj = 0;
+	filter->xsaw_secondary = filter->ysaw_secondary = 0;
+	psmouse_filter_reset_spew(filter);
+}
+
+/*
+ * Throw out oddly large delta packets, and any that immediately follow whose
+ * values are each approximately half of the previous.  It seems that the ALPS
+ * firmware emits errant packets, and they get averaged out slowly.
+ */
+static unsigned int psmouse_filter_jumps(struct psmouse *psmouse,
+					 struct psmouse_filter *filter,
+					 int x, int y)
+{
+	int delta = filter->jump_delta;
+	unsigned int flags = 0;
+	int avx, avy;
+
+	avx = abs(x);
+	avy = abs(y);
+
+	/* discard if too big, or half that but > 4 times the prev delta */
+	if (avx > delta ||
+		(avx > delta / 2 && ((avx / 4) > filter->xlast))) {
+		psmouse_warn(psmouse, "detected %dpx jump in x\n", x);
+		filter->xbigj = avx;
+	} else if (approx_half(avx, filter->xbigj)) {
+		psmouse_warn(psmouse, "detected secondary %dpx jump in x\n", x);
+		filter->xbigj = avx;
+		filter->xsaw_secondary++;
+	} else {
+		if (filter->xbigj && filter->xsaw_secondary > 1)
+			flags |= PSMOUSE_FILTER_JUMPY;
+		filter->xbigj = 0;
+		filter->xsaw_secondary = 0;
+	}
+
+	if (avy > delta ||
+		(avy > delta / 2 && ((avy / 4) > filter->ylast))) {
+		psmouse_warn(psmouse, "detected %dpx jump in y\n", y);
+		filter->ybigj = avy;
+	} else if (approx_half(avy, filter->ybigj)) {
+		psmouse_warn(psmouse, "detected secondary %dpx jump in y\n", y);
+		filter->ybigj = avy;
+		filter->ysaw_secondary++;
+	} else {
+		if (filter->ybigj && filter->ysaw_secondary > 1)
+			flags |= PSMOUSE_FILTER_JUMPY;
+		filter->ybigj = 0;
+		filter->ysaw_secondary = 0;
+	}
+
+	filter->xlast = avx;
+	filter->ylast = avy;
+
+	if (filter->xbigj || filter->ybigj)
+		flags |= PSMOUSE_FILTER_DISCARD;
+
+	return flags;
+}
+
+/*
+ * We have no idea why this particular hardware bug occurs.  The touchpad
+ * will randomly start spewing packets without anything touching the
+ * pad.  This wouldn't necessarily be bad, but it's indicative of a
+ * severely miscalibrated pad; attempting to use the touchpad while it's
+ * spewing means the cursor will jump all over the place, and act "drunk".
+ *
+ * The packets that are spewed tend to all have deltas between -2 and 2, and
+ * the cursor will move around without really going very far.  It will
+ * tend to end up in the same location; if we tally up the changes over
+ * 100 packets, we end up w/ a final delta of close to 0.  This happens
+ * pretty regularly when the touchpad is spewing, and is pretty hard to
+ * manually trigger (at least for *my* fingers).  So, it makes a perfect
+ * scheme for detecting spews.
+ */
+static unsigned int psmouse_filter_spew(struct psmouse *psmouse,
+					struct psmouse_filter *filter,
+					int x, int y)
+{
+	if (abs(x) > 3 || abs(y) > 3) {
+		/* no spew, or spew ended */
+		psmouse_filter_reset_spew(filter);
+		return 0;
+	}
+
+	/* Keep a tally of the overall delta to the cursor position caused by
+	 * the spew */
+	filter->x_tally += x;
+	filter->y_tally += y;
+
+	switch (filter->spew_state) {
+	case PSMOUSE_NO_SPEW:
+		/* we're not spewing, but this packet might be the start */
+		filter->spew_state = PSMOUSE_MAYBE_SPEWING;
+
+		/* fall-through */
+
+	case PSMOUSE_MAYBE_SPEWING:
+		filter->spew_packets++;
+
+		if (filter->spew_packets < filter->spew_count)
+			break;
+
+		/* excessive spew detected */
+		filter->spew_state = PSMOUSE_SPEW_DETECTED;
+
+		/* fall-through */
+
+	case PSMOUSE_SPEW_DETECTED:
+		/* only report spew when the overall delta to the cursor
+		 * is really small. if the spew is causing significant cursor
+		 * movement, it is probably a case of the user moving the
+		 * cursor very slowly across the screen. */
+		if (abs(filter->x_tally) < 3 && abs(filter->y_tally) < 3) {
+			psmouse_warn(psmouse, "packet spew detected (%d,%d)\n",
+				     filter->x_tally, filter->y_tally);
+			filter->spew_state = PSMOUSE_SPEW_REPORTED;
+			return PSMOUSE_FILTER_SPEW;
+		}
+
+		break;
+	case PSMOUSE_SPEW_REPORTED:
+		/* we already reported the spew, wait for the protocol
+		 * to reset the filter once it has dealt with it. */
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * psmouse_filter_motion() runs one packet worth of relative motion
+ * through the filter and returns a mask of PSMOUSE_FILTER_* flags:
+ * DISCARD asks the caller to drop the motion of this packet, JUMPY and
+ * SPEW tell that the device is likely miscalibrated.
+ */
+unsigned int psmouse_filter_motion(struct psmouse *psmouse,
+				   int x, int y, bool buttons)
+{
+	struct psmouse_filter *filter = &psmouse->filter;
+	unsigned int flags = 0;
+
+	if (filter->jump_delta) {
+		flags = psmouse_filter_jumps(psmouse, filter, x, y);
+		if (flags & PSMOUSE_FILTER_DISCARD)
+			return flags;
+	}
+
+	/* ignore button press packets; many in a row could trigger
+	 * a false-positive! */
+	if (filter->spew_count && !buttons)
+		flags |= psmouse_filter_spew(psmouse, filter, x, y);
+
+	return flags;
+}
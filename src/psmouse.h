@@ -29,6 +29,106 @@ enum psmouse_state {
 	PSMOUSE_ACTIVATED,
 };
 
+enum psmouse_spew_state {
+	PSMOUSE_NO_SPEW,
+	PSMOUSE_MAYBE_SPEWING,
+	PSMOUSE_SPEW_DETECTED,
+	PSMOUSE_SPEW_REPORTED,
+};
+
+/*
+ * Relative motion filter, see psmouse-filter.c. Protocols opt in by
+ * setting jump_delta and/or spew_count.
+ */
+struct psmouse_filter {
+	unsigned int jump_delta;	/* deltas this large are discarded */
+	unsigned int spew_count;	/* packets of jitter making a spew */
+
+	int xbigj, ybigj, xlast, ylast;		/* jumpiness detection */
+	int xsaw_secondary, ysaw_secondary;	/* jumpiness detection */
+	int spew_packets, x_tally, y_tally;	/* spew detection */
+	enum psmouse_spew_state spew_state;
+};
+
+#define PSMOUSE_FILTER_DISCARD	0x01	/* drop motion of this packet */
+#define PSMOUSE_FILTER_JUMPY	0x02	/* repeated jumps detected */
+#define PSMOUSE_FILTER_SPEW	0x04	/* packet spew detected */
+
+/*
+ * Declarative validation of fixed-format packets, see psmouse_check_byte().
+ * A check passes when the bits of packet[pos] selected by mask, XORed with
+ * packet[ref] >> shift (or with nothing if ref is PSMOUSE_CHECK_NO_REF),
+ * equal expect. This covers both fixed bit patterns and bits that repeat
+ * those of another (or the same) byte.
+ */
+struct psmouse_byte_check {
+	unsigned char pos;
+	unsigned char ref;
+	unsigned char shift;
+	unsigned char mask;
+	unsigned char expect;
+};
+
+#define PSMOUSE_CHECK_NO_REF	0xff
+
+/* (packet[_pos] & _mask) == _expect */
+#define PSMOUSE_CHECK(_pos, _mask, _expect)				\
+	{ .pos = _pos, .ref = PSMOUSE_CHECK_NO_REF,			\
+	  .mask = _mask, .expect = _expect }
+
+/* (packet[_pos] & _mask) == ((packet[_ref] >> _shift) & _mask) */
+#define PSMOUSE_CHECK_SAME(_pos, _ref, _shift, _mask)			\
+	{ .pos = _pos, .ref = _ref, .shift = _shift, .mask = _mask }
+
+/*
+ * Transport error counters, updated from the interrupt handler and
+ * summarized from the workqueue, see psmouse_stats_work().
+ */
+struct psmouse_stats {
+	unsigned long lost_sync[8];	/* bad data, by byte index in packet */
+	unsigned long stale_packets;	/* partial packets thrown away */
+	unsigned long parity_errors;
+	unsigned long timeouts;
+	unsigned long resyncs;		/* recoveries after losing sync */
+};
+
+struct dentry;
+struct psmouse;
+struct seq_file;
+
+/*
+ * Packet trace ring exported through debugfs, see psmouse_trace_init().
+ * Protocols embed one in their private data and record complete (or
+ * rejected) packets from the interrupt handler while tracing is enabled.
+ */
+#define PSMOUSE_TRACE_SIZE	256	/* must be a power of 2 */
+
+struct psmouse_trace_record {
+	u64 time_ns;
+	unsigned char packet[8];
+	unsigned char len;
+	unsigned char type;		/* protocol packet classification */
+	unsigned char aux[2];		/* protocol decoder state */
+};
+
+struct psmouse_trace_format {
+	const char *name;		/* debugfs directory prefix */
+	const char * const *type_names;
+	unsigned int num_types;
+	unsigned int num_aux;		/* aux values printed per packet */
+	void (*show_header)(struct seq_file *s, struct psmouse *psmouse);
+};
+
+struct psmouse_trace {
+	u32 enabled;			/* debugfs "enabled" */
+	unsigned int head;
+	struct psmouse_trace_record ring[PSMOUSE_TRACE_SIZE];
+
+	struct psmouse *psmouse;
+	const struct psmouse_trace_format *format;
+	struct dentry *dir;
+};
+
 /* psmouse protocol handler return codes */
 typedef enum {
 	PSMOUSE_BAD_DATA,
@@ -41,6 +141,7 @@ struct psmouse {
 	struct input_dev *dev;
 	struct ps2dev ps2dev;
 	struct delayed_work resync_work;
+	struct delayed_work stats_work;
 	char *vendor;
 	char *name;
 	unsigned char packet[8];
@@ -51,7 +152,9 @@ struct psmouse {
 	bool ignore_parity;
 	bool acks_disable_command;
 	unsigned int model;
-	unsigned long last;
+	ktime_t last;			/* arrival of the last byte */
+	ktime_t packet_time;		/* arrival of the current packet */
+	ktime_t prev_packet_time;	/* arrival of the previous packet */
 	unsigned long out_of_sync_cnt;
 	unsigned long num_resyncs;
 	enum psmouse_state state;
@@ -62,7 +165,18 @@ struct psmouse {
 	unsigned int resolution;
 	unsigned int resetafter;
 	unsigned int resync_time;
+	unsigned int sync_timeout;	/* ms, see psmouse_interrupt() */
 	bool smartscroll;	/* Logitech only */
+	bool sync_dedup;	/* drop repeated packets without motion */
+	bool last_packet_valid;
+	unsigned char last_packet[8];	/* last packet reported */
+	unsigned long frames_synced;
+	unsigned long frames_suppressed;
+
+	struct psmouse_filter filter;
+
+	struct psmouse_stats stats;
+	struct psmouse_stats stats_reported;	/* as of the last summary */
 
 	psmouse_ret_t (*protocol_handler)(struct psmouse *psmouse);
 	void (*set_rate)(struct psmouse *psmouse, unsigned int rate);
@@ -107,6 +221,23 @@ int psmouse_reset(struct psmouse *psmouse);
 void psmouse_set_state(struct psmouse *psmouse, enum psmouse_state new_state);
 void psmouse_set_resolution(struct psmouse *psmouse, unsigned int resolution);
 psmouse_ret_t psmouse_process_byte(struct psmouse *psmouse);
+void psmouse_set_wheel(struct input_dev *dev, unsigned int code);
+void psmouse_report_wheel(struct input_dev *dev, unsigned int code, int detents);
+bool psmouse_repeated_packet(struct psmouse *psmouse, bool motion);
+bool psmouse_check_byte(const struct psmouse_byte_check *checks,
+			unsigned int count, const unsigned char *packet,
+			unsigned int pos);
+struct psmouse_trace_record *psmouse_trace_begin(struct psmouse_trace *trace,
+						  unsigned char type);
+void psmouse_trace_commit(struct psmouse_trace *trace);
+void psmouse_trace_init(struct psmouse_trace *trace, struct psmouse *psmouse,
+			const struct psmouse_trace_format *format);
+void psmouse_trace_cleanup(struct psmouse_trace *trace);
+void psmouse_filter_reset(struct psmouse_filter *filter);
+unsigned int psmouse_filter_motion(struct psmouse *psmouse,
+				   int x, int y, bool buttons);
+bool psmouse_pass_packet(struct serio *serio,
+			 const unsigned char *packet, unsigned int len);
 int psmouse_activate(struct psmouse *psmouse);
 int psmouse_deactivate(struct psmouse *psmouse);
 bool psmouse_matches_pnp_id(struct psmouse *psmouse, const char * const ids[]);
@@ -24,8 +24,8 @@
 #include <linux/input/mt.h>
 #include <linux/ctype.h>
 #include <linux/libps2.h>
+#include <linux/seq_file.h>
 #include <linux/serio.h>
-#include <linux/jiffies.h>
 #include <linux/slab.h>
 
 #include "psmouse.h"
@@ -81,21 +81,35 @@ static unsigned char fsp_test_invert_cmd(unsigned char reg_val)
 	}
 }
 
-static int fsp_reg_read(struct psmouse *psmouse, int reg_addr, int *reg_val)
+/*
+ * We need to shut off the device and switch it into command mode for
+ * register reads so we don't confuse our protocol handler. Callers that
+ * already run with the device deactivated (the sysfs set helper, init and
+ * reconnect) share their command window; otherwise a window is opened here
+ * and closed by fsp_cmd_window_end().
+ */
+static bool fsp_cmd_window_begin(struct psmouse *psmouse)
+{
+	if (psmouse->state != PSMOUSE_ACTIVATED)
+		return false;
+
+	psmouse_deactivate(psmouse);
+	return true;
+}
+
+static void fsp_cmd_window_end(struct psmouse *psmouse, bool opened)
+{
+	if (opened)
+		psmouse_activate(psmouse);
+}
+
+static int __fsp_reg_read(struct psmouse *psmouse, int reg_addr, int *reg_val)
 {
 	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	unsigned char param[3];
 	unsigned char addr;
 	int rc = -1;
 
-	/*
-	 * We need to shut off the device and switch it into command
-	 * mode so we don't confuse our protocol handler. We don't need
-	 * to do that for writes because sysfs set helper does this for
-	 * us.
-	 */
-	psmouse_deactivate(psmouse);
-
 	ps2_begin_command(ps2dev);
 
 	if (ps2_sendbyte(ps2dev, 0xf3, FSP_CMD_TIMEOUT) < 0)
@@ -131,13 +145,39 @@ static int fsp_reg_read(struct psmouse *psmouse, int reg_addr, int *reg_val)
 
  out:
 	ps2_end_command(ps2dev);
-	psmouse_activate(psmouse);
 	psmouse_dbg(psmouse,
 		    "READ REG: 0x%02x is 0x%02x (rc = %d)\n",
 		    reg_addr, *reg_val, rc);
 	return rc;
 }
 
+static int fsp_reg_read(struct psmouse *psmouse, int reg_addr, int *reg_val)
+{
+	bool window = fsp_cmd_window_begin(psmouse);
+	int rc;
+
+	rc = __fsp_reg_read(psmouse, reg_addr, reg_val);
+
+	fsp_cmd_window_end(psmouse, window);
+	return rc;
+}
+
+/*
+ * Read a list of registers within a single command window.
+ */
+static int fsp_reg_read_batch(struct psmouse *psmouse,
+			      const unsigned char *regs, int *vals, int count)
+{
+	bool window = fsp_cmd_window_begin(psmouse);
+	int i, rc = 0;
+
+	for (i = 0; i < count && rc == 0; i++)
+		rc = __fsp_reg_read(psmouse, regs[i], &vals[i]);
+
+	fsp_cmd_window_end(psmouse, window);
+	return rc;
+}
+
 static int fsp_reg_write(struct psmouse *psmouse, int reg_addr, int reg_val)
 {
 	struct ps2dev *ps2dev = &psmouse->ps2dev;
@@ -211,14 +251,34 @@ static int fsp_reg_write_enable(struct psmouse *psmouse, bool enable)
 	return 0;
 }
 
-static int fsp_page_reg_read(struct psmouse *psmouse, int *reg_val)
+/*
+ * Write a list of register/value pairs within a single command window,
+ * enabling register clock gating only once for the whole batch.
+ */
+static int fsp_reg_write_batch(struct psmouse *psmouse,
+			       const unsigned char *regs, const int *vals,
+			       int count)
+{
+	bool window = fsp_cmd_window_begin(psmouse);
+	int i, rc = -1;
+
+	if (fsp_reg_write_enable(psmouse, true) == 0) {
+		for (i = 0, rc = 0; i < count && rc == 0; i++)
+			rc = fsp_reg_write(psmouse, regs[i], vals[i]);
+
+		fsp_reg_write_enable(psmouse, false);
+	}
+
+	fsp_cmd_window_end(psmouse, window);
+	return rc;
+}
+
+static int __fsp_page_reg_read(struct psmouse *psmouse, int *reg_val)
 {
 	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	unsigned char param[3];
 	int rc = -1;
 
-	psmouse_deactivate(psmouse);
-
 	ps2_begin_command(ps2dev);
 
 	if (ps2_sendbyte(ps2dev, 0xf3, FSP_CMD_TIMEOUT) < 0)
@@ -242,14 +302,40 @@ static int fsp_page_reg_read(struct psmouse *psmouse, int *reg_val)
 
  out:
 	ps2_end_command(ps2dev);
-	psmouse_activate(psmouse);
 	psmouse_dbg(psmouse,
 		    "READ PAGE REG: 0x%02x (rc = %d)\n",
 		    *reg_val, rc);
 	return rc;
 }
 
-static int fsp_page_reg_write(struct psmouse *psmouse, int reg_val)
+/*
+ * The page register only changes when we write it, so it is read from the
+ * device once and served from the cache afterwards.
+ */
+static int fsp_page_reg_read(struct psmouse *psmouse, int *reg_val)
+{
+	struct fsp_data *pad = psmouse->private;
+	bool window;
+	int rc;
+
+	if (pad->page_valid) {
+		*reg_val = pad->page;
+		return 0;
+	}
+
+	window = fsp_cmd_window_begin(psmouse);
+	rc = __fsp_page_reg_read(psmouse, reg_val);
+	fsp_cmd_window_end(psmouse, window);
+
+	if (rc == 0) {
+		pad->page = *reg_val;
+		pad->page_valid = true;
+	}
+
+	return rc;
+}
+
+static int __fsp_page_reg_write(struct psmouse *psmouse, int reg_val)
 {
 	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	unsigned char v;
@@ -287,6 +373,22 @@ static int fsp_page_reg_write(struct psmouse *psmouse, int reg_val)
 	return rc;
 }
 
+static int fsp_page_reg_write(struct psmouse *psmouse, int reg_val)
+{
+	struct fsp_data *pad = psmouse->private;
+	int rc;
+
+	if (pad->page_valid && pad->page == reg_val)
+		return 0;
+
+	rc = __fsp_page_reg_write(psmouse, reg_val);
+
+	pad->page = reg_val;
+	pad->page_valid = rc == 0;
+
+	return rc;
+}
+
 static int fsp_get_version(struct psmouse *psmouse, int *version)
 {
 	if (fsp_reg_read(psmouse, FSP_REG_VERSION, version))
@@ -305,19 +407,18 @@ static int fsp_get_revision(struct psmouse *psmouse, int *rev)
 
 static int fsp_get_sn(struct psmouse *psmouse, int *sn)
 {
-	int v0, v1, v2;
+	static const unsigned char regs[] = {
+		FSP_REG_SN0, FSP_REG_SN1, FSP_REG_SN2
+	};
+	int v[ARRAY_SIZE(regs)];
 	int rc = -EIO;
 
 	/* production number since Cx is available at: 0x0b40 ~ 0x0b42 */
 	if (fsp_page_reg_write(psmouse, FSP_PAGE_0B))
 		goto out;
-	if (fsp_reg_read(psmouse, FSP_REG_SN0, &v0))
+	if (fsp_reg_read_batch(psmouse, regs, v, ARRAY_SIZE(regs)))
 		goto out;
-	if (fsp_reg_read(psmouse, FSP_REG_SN1, &v1))
-		goto out;
-	if (fsp_reg_read(psmouse, FSP_REG_SN2, &v2))
-		goto out;
-	*sn = (v0 << 16) | (v1 << 8) | v2;
+	*sn = (v[0] << 16) | (v[1] << 8) | v[2];
 	rc = 0;
 out:
 	fsp_page_reg_write(psmouse, FSP_PAGE_DEFAULT);
@@ -395,14 +496,18 @@ static int fsp_onpad_vscr(struct psmouse *psmouse, bool enable)
 
 static int fsp_onpad_hscr(struct psmouse *psmouse, bool enable)
 {
+	static const unsigned char regs[] = {
+		FSP_REG_ONPAD_CTL, FSP_REG_SYSCTL5
+	};
 	struct fsp_data *pad = psmouse->private;
+	int v[ARRAY_SIZE(regs)];
 	int val, v2;
 
-	if (fsp_reg_read(psmouse, FSP_REG_ONPAD_CTL, &val))
+	if (fsp_reg_read_batch(psmouse, regs, v, ARRAY_SIZE(regs)))
 		return -EIO;
 
-	if (fsp_reg_read(psmouse, FSP_REG_SYSCTL5, &v2))
-		return -EIO;
+	val = v[0];
+	v2 = v[1];
 
 	pad->hscroll = enable;
 
@@ -425,34 +530,48 @@ static int fsp_onpad_hscr(struct psmouse *psmouse, bool enable)
 }
 
 /*
- * Write device specific initial parameters.
+ * Write device specific initial parameters. Several register/value pairs
+ * may be given at once; they are written in order within a single
+ * command window.
  *
  * ex: 0xab 0xcd - write oxcd into register 0xab
+ * ex: 0xab 0xcd 0x12 0x34 - also write 0x34 into register 0x12
  */
 static ssize_t fsp_attr_set_setreg(struct psmouse *psmouse, void *data,
 				   const char *buf, size_t count)
 {
-	int reg, val;
+	unsigned char regs[FSP_REG_BATCH_MAX];
+	int vals[FSP_REG_BATCH_MAX];
+	unsigned long reg, val;
+	const char *p = buf;
 	char *rest;
-	ssize_t retval;
+	int n = 0;
 
-	reg = simple_strtoul(buf, &rest, 16);
-	if (rest == buf || *rest != ' ' || reg > 0xff)
-		return -EINVAL;
+	while (n < FSP_REG_BATCH_MAX) {
+		p = skip_spaces(p);
+		if (*p == '\0')
+			break;
 
-	retval = kstrtoint(rest + 1, 16, &val);
-	if (retval)
-		return retval;
+		reg = simple_strtoul(p, &rest, 16);
+		if (rest == p || !isspace(*rest) || reg > 0xff)
+			return -EINVAL;
 
-	if (val > 0xff)
-		return -EINVAL;
+		p = skip_spaces(rest);
+		val = simple_strtoul(p, &rest, 16);
+		if (rest == p || val > 0xff)
+			return -EINVAL;
 
-	if (fsp_reg_write_enable(psmouse, true))
-		return -EIO;
+		regs[n] = reg;
+		vals[n] = val;
+		n++;
+		p = rest;
+	}
 
-	retval = fsp_reg_write(psmouse, reg, val) < 0 ? -EIO : count;
+	if (n == 0 || *skip_spaces(p) != '\0')
+		return -EINVAL;
 
-	fsp_reg_write_enable(psmouse, false);
+	if (fsp_reg_write_batch(psmouse, regs, vals, n))
+		return -EIO;
 
 	return count;
 }
@@ -643,52 +762,32 @@ static struct attribute_group fsp_attribute_group = {
 	.attrs = fsp_attributes,
 };
 
-#ifdef	FSP_DEBUG
-static void fsp_packet_debug(struct psmouse *psmouse, unsigned char packet[])
-{
-	static unsigned int ps2_packet_cnt;
-	static unsigned int ps2_last_second;
-	unsigned int jiffies_msec;
-	const char *packet_type = "UNKNOWN";
-	unsigned short abs_x = 0, abs_y = 0;
-
-	/* Interpret & dump the packet data. */
-	switch (packet[0] >> FSP_PKT_TYPE_SHIFT) {
-	case FSP_PKT_TYPE_ABS:
-		packet_type = "Absolute";
-		abs_x = GET_ABS_X(packet);
-		abs_y = GET_ABS_Y(packet);
-		break;
-	case FSP_PKT_TYPE_NORMAL:
-		packet_type = "Normal";
-		break;
-	case FSP_PKT_TYPE_NOTIFY:
-		packet_type = "Notify";
-		break;
-	case FSP_PKT_TYPE_NORMAL_OPC:
-		packet_type = "Normal-OPC";
-		break;
-	}
+static const char * const fsp_packet_type_names[] = {
+	[FSP_PKT_TYPE_NORMAL]		= "normal",
+	[FSP_PKT_TYPE_ABS]		= "abs",
+	[FSP_PKT_TYPE_NOTIFY]		= "notify",
+	[FSP_PKT_TYPE_NORMAL_OPC]	= "normal-opc",
+};
 
-	ps2_packet_cnt++;
-	jiffies_msec = jiffies_to_msecs(jiffies);
-	psmouse_dbg(psmouse,
-		    "%08dms %s packets: %02x, %02x, %02x, %02x; "
-		    "abs_x: %d, abs_y: %d\n",
-		    jiffies_msec, packet_type,
-		    packet[0], packet[1], packet[2], packet[3], abs_x, abs_y);
-
-	if (jiffies_msec - ps2_last_second > 1000) {
-		psmouse_dbg(psmouse, "PS/2 packets/sec = %d\n", ps2_packet_cnt);
-		ps2_packet_cnt = 0;
-		ps2_last_second = jiffies_msec;
-	}
-}
-#else
-static void fsp_packet_debug(struct psmouse *psmouse, unsigned char packet[])
+static void fsp_trace_header(struct seq_file *s, struct psmouse *psmouse)
 {
+	struct fsp_data *ad = psmouse->private;
+
+	seq_printf(s, "# sentelic hw %d.%d.%d\n",
+		   ad->ver >> 4, ad->ver & 0x0F, ad->rev);
 }
-#endif
+
+/*
+ * Packets are followed by the number of fingers reported for them and
+ * the last MFMC finger seen.
+ */
+static const struct psmouse_trace_format fsp_trace_format = {
+	.name		= "sentelic",
+	.type_names	= fsp_packet_type_names,
+	.num_types	= ARRAY_SIZE(fsp_packet_type_names),
+	.num_aux	= 2,
+	.show_header	= fsp_trace_header,
+};
 
 static void fsp_set_slot(struct input_dev *dev, int slot, bool active,
 			 unsigned int x, unsigned int y)
@@ -705,6 +804,7 @@ static psmouse_ret_t fsp_process_byte(struct psmouse *psmouse)
 {
 	struct input_dev *dev = psmouse->dev;
 	struct fsp_data *ad = psmouse->private;
+	struct psmouse_trace_record *rec;
 	unsigned char *packet = psmouse->packet;
 	unsigned char button_status = 0, lscroll = 0, rscroll = 0;
 	unsigned short abs_x, abs_y, fgrs = 0;
@@ -717,7 +817,8 @@ static psmouse_ret_t fsp_process_byte(struct psmouse *psmouse)
 	 * Full packet accumulated, process it
 	 */
 
-	fsp_packet_debug(psmouse, packet);
+	rec = psmouse_trace_begin(&ad->trace,
+				  packet[0] >> FSP_PKT_TYPE_SHIFT);
 
 	switch (psmouse->packet[0] >> FSP_PKT_TYPE_SHIFT) {
 	case FSP_PKT_TYPE_ABS:
@@ -852,6 +953,12 @@ static psmouse_ret_t fsp_process_byte(struct psmouse *psmouse)
 
 	input_sync(dev);
 
+	if (rec) {
+		rec->aux[0] = fgrs;
+		rec->aux[1] = ad->last_mt_fgr;
+		psmouse_trace_commit(&ad->trace);
+	}
+
 	return PSMOUSE_FULL_PACKET;
 }
 
@@ -1006,6 +1113,9 @@ static void fsp_reset(struct psmouse *psmouse)
 
 static void fsp_disconnect(struct psmouse *psmouse)
 {
+	struct fsp_data *pad = psmouse->private;
+
+	psmouse_trace_cleanup(&pad->trace);
 	sysfs_remove_group(&psmouse->ps2dev.serio->dev.kobj,
 			   &fsp_attribute_group);
 
@@ -1015,8 +1125,12 @@ static void fsp_disconnect(struct psmouse *psmouse)
 
 static int fsp_reconnect(struct psmouse *psmouse)
 {
+	struct fsp_data *pad = psmouse->private;
 	int version;
 
+	/* the device has been reset, so has its page register */
+	pad->page_valid = false;
+
 	if (fsp_detect(psmouse, 0))
 		return -ENODEV;
 
@@ -1035,9 +1149,14 @@ int fsp_init(struct psmouse *psmouse)
 	int ver, rev, sn = 0;
 	int error;
 
+	psmouse->private = priv = kzalloc(sizeof(struct fsp_data), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
 	if (fsp_get_version(psmouse, &ver) ||
 	    fsp_get_revision(psmouse, &rev)) {
-		return -ENODEV;
+		error = -ENODEV;
+		goto err_out;
 	}
 	if (ver >= FSP_VER_STL3888_C0) {
 		/* firmware information is only available since C0 */
@@ -1048,10 +1167,6 @@ int fsp_init(struct psmouse *psmouse)
 		     "Finger Sensing Pad, hw: %d.%d.%d, sn: %x, sw: %s\n",
 		     ver >> 4, ver & 0x0F, rev, sn, fsp_drv_ver);
 
-	psmouse->private = priv = kzalloc(sizeof(struct fsp_data), GFP_KERNEL);
-	if (!priv)
-		return -ENOMEM;
-
 	priv->ver = ver;
 	priv->rev = rev;
 
@@ -1078,9 +1193,12 @@ int fsp_init(struct psmouse *psmouse)
 		goto err_out;
 	}
 
+	psmouse_trace_init(&priv->trace, psmouse, &fsp_trace_format);
+
 	return 0;
 
  err_out:
+	psmouse_trace_cleanup(&priv->trace);
 	kfree(psmouse->private);
 	psmouse->private = NULL;
 	return error;
@@ -73,6 +73,9 @@
 #define	FSP_REG_SN1		(0x41)
 #define	FSP_REG_SN2		(0x42)
 
+/* Maximum number of registers accessed in one batch over sysfs */
+#define	FSP_REG_BATCH_MAX	16
+
 /* Finger-sensing Pad packet formating related definitions */
 
 /* absolute packet type */
@@ -116,7 +119,12 @@ struct fsp_data {
 
 	unsigned char	last_reg;	/* Last register we requested read from */
 	unsigned char	last_val;
+	unsigned char	page;		/* Cached page register */
+	bool		page_valid;
 	unsigned int	last_mt_fgr;	/* Last seen finger(multitouch) */
+
+	/* Packet trace, aux holds fingers reported and last MFMC finger */
+	struct psmouse_trace trace;
 };
 
 #ifdef CONFIG_MOUSE_PS2_SENTELIC
@@ -508,6 +508,13 @@ static int synaptics_is_pt_packet(unsigned char *buf)
 static void synaptics_pass_pt_packet(struct serio *ptport, unsigned char *packet)
 {
 	struct psmouse *child = serio_get_drvdata(ptport);
+	unsigned char pt_packet[4] = {
+		packet[1], packet[4], packet[5], packet[2]
+	};
+
+	/* Fast path: hand the whole guest packet to the child at once */
+	if (psmouse_pass_packet(ptport, pt_packet, sizeof(pt_packet)))
+		return;
 
 	if (child && child->state == PSMOUSE_ACTIVATED) {
 		serio_interrupt(ptport, packet[1], 0);
@@ -1190,6 +1197,7 @@ static void synaptics_process_packet(struct psmouse *psmouse)
 	struct synaptics_hw_state hw;
 	int num_fingers;
 	int finger_width;
+	int notches;
 
 	if (synaptics_parse_hw_state(psmouse->packet, priv, &hw))
 		return;
@@ -1200,22 +1208,25 @@ static void synaptics_process_packet(struct psmouse *psmouse)
 	}
 
 	if (hw.scroll) {
+		/*
+		 * The scroll strip reports SYN_SCROLL_UNITS per wheel notch.
+		 * Whole notches go out as REL_WHEEL, the remainder is carried
+		 * over to the next packet, and the raw movement is reported
+		 * as high-resolution wheel data where the kernel supports it.
+		 * Positive strip movement scrolls down.
+		 */
 		priv->scroll += hw.scroll;
+		notches = priv->scroll / SYN_SCROLL_UNITS;
+		priv->scroll -= notches * SYN_SCROLL_UNITS;
 
-		while (priv->scroll >= 4) {
-			input_report_key(dev, BTN_BACK, !hw.down);
-			input_sync(dev);
-			input_report_key(dev, BTN_BACK, hw.down);
-			input_sync(dev);
-			priv->scroll -= 4;
-		}
-		while (priv->scroll <= -4) {
-			input_report_key(dev, BTN_FORWARD, !hw.up);
-			input_sync(dev);
-			input_report_key(dev, BTN_FORWARD, hw.up);
-			input_sync(dev);
-			priv->scroll += 4;
-		}
+#ifdef REL_WHEEL_HI_RES
+		input_report_rel(dev, REL_WHEEL_HI_RES,
+				 -hw.scroll * (120 / SYN_SCROLL_UNITS));
+#endif
+		if (notches)
+			input_report_rel(dev, REL_WHEEL, -notches);
+
+		input_sync(dev);
 		return;
 	}
 
@@ -1243,9 +1254,25 @@ static void synaptics_process_packet(struct psmouse *psmouse)
 		finger_width = 0;
 	}
 
-	if (SYN_CAP_ADV_GESTURE(priv->ext_cap_0c))
-		synaptics_report_semi_mt_data(dev, &hw, &priv->agm,
-					      num_fingers);
+	if (SYN_CAP_ADV_GESTURE(priv->ext_cap_0c)) {
+		/*
+		 * With two or more fingers the touchpad sends an AGM packet
+		 * followed by an SGM packet, and only the complete pair
+		 * describes the contacts. If the AGM half is missing we leave
+		 * the MT slots alone rather than pairing the SGM with stale
+		 * AGM data; the single-touch data below is still reported.
+		 */
+		if (num_fingers < 2) {
+			if (priv->agm_pending)
+				priv->agm_orphaned++;
+			synaptics_report_semi_mt_data(dev, &hw, &priv->agm,
+						      num_fingers);
+		} else if (priv->agm_pending) {
+			synaptics_report_semi_mt_data(dev, &hw, &priv->agm,
+						      num_fingers);
+		}
+		priv->agm_pending = false;
+	}
 
 	/* Post events
 	 * BTN_TOUCH has to be first as mousedev relies on it when doing
@@ -1417,8 +1444,7 @@ static void set_input_params(struct psmouse *psmouse,
 		__set_bit(BTN_TOOL_TRIPLETAP, dev->keybit);
 	}
 
-	if (SYN_CAP_FOUR_BUTTON(priv->capabilities) ||
-	    SYN_CAP_MIDDLE_BUTTON(priv->capabilities)) {
+	if (SYN_CAP_FOUR_BUTTON(priv->capabilities)) {
 		__set_bit(BTN_FORWARD, dev->keybit);
 		__set_bit(BTN_BACK, dev->keybit);
 	}
@@ -1430,6 +1456,20 @@ static void set_input_params(struct psmouse *psmouse,
 	__clear_bit(REL_X, dev->relbit);
 	__clear_bit(REL_Y, dev->relbit);
 
+	/*
+	 * Scroll strip on touchpads with a middle button. Clickpads use that
+	 * bit for their button and image sensors never report the strip.
+	 */
+	if (SYN_CAP_MIDDLE_BUTTON(priv->capabilities) &&
+	    !SYN_CAP_CLICKPAD(priv->ext_cap_0c) &&
+	    !SYN_CAP_IMAGE_SENSOR(priv->ext_cap_0c)) {
+		__set_bit(EV_REL, dev->evbit);
+		__set_bit(REL_WHEEL, dev->relbit);
+#ifdef REL_WHEEL_HI_RES
+		__set_bit(REL_WHEEL_HI_RES, dev->relbit);
+#endif
+	}
+
 	if (SYN_CAP_CLICKPAD(priv->ext_cap_0c)) {
 		__set_bit(INPUT_PROP_BUTTONPAD, dev->propbit);
 		if (psmouse_matches_pnp_id(psmouse, topbuttonpad_pnp_ids))
@@ -1484,6 +1524,28 @@ PSMOUSE_DEFINE_ATTR(disable_gesture, S_IWUSR | S_IRUGO, NULL,
 		    synaptics_show_disable_gesture,
 		    synaptics_set_disable_gesture);
 
+static ssize_t synaptics_show_agm_orphaned(struct psmouse *psmouse,
+					   void *data, char *buf)
+{
+	struct synaptics_data *priv = psmouse->private;
+
+	return sprintf(buf, "%lu\n", priv->agm_orphaned);
+}
+
+PSMOUSE_DEFINE_RO_ATTR(agm_orphaned, S_IRUGO, NULL,
+		       synaptics_show_agm_orphaned);
+
+/*
+ * Only advanced gesture pads pair each AGM packet with one SGM packet;
+ * image sensors send an AGM-CONTACT packet along with it.
+ */
+static bool synaptics_pairs_agm(struct synaptics_data *priv)
+{
+	return priv->absolute_mode &&
+	       SYN_CAP_ADV_GESTURE(priv->ext_cap_0c) &&
+	       !SYN_CAP_IMAGE_SENSOR(priv->ext_cap_0c);
+}
+
 static void synaptics_disconnect(struct psmouse *psmouse)
 {
 	struct synaptics_data *priv = psmouse->private;
@@ -1492,6 +1554,10 @@ static void synaptics_disconnect(struct psmouse *psmouse)
 		device_remove_file(&psmouse->ps2dev.serio->dev,
 				   &psmouse_attr_disable_gesture.dattr);
 
+	if (synaptics_pairs_agm(priv))
+		device_remove_file(&psmouse->ps2dev.serio->dev,
+				   &psmouse_attr_agm_orphaned.dattr);
+
 	synaptics_reset(psmouse);
 	kfree(priv);
 	psmouse->private = NULL;
@@ -1732,6 +1798,17 @@ static int __synaptics_init(struct psmouse *psmouse, bool absolute_mode)
 		}
 	}
 
+	if (synaptics_pairs_agm(priv)) {
+		err = device_create_file(&psmouse->ps2dev.serio->dev,
+					 &psmouse_attr_agm_orphaned.dattr);
+		if (err) {
+			psmouse_err(psmouse,
+				    "Failed to create agm_orphaned attribute (%d)",
+				    err);
+			goto init_fail;
+		}
+	}
+
 	return 0;
 
  init_fail:
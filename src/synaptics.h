@@ -116,6 +116,9 @@
 #define SYN_NEWABS_RELAXED		2
 #define SYN_OLDABS			3
 
+/* scroll strip movement corresponding to one wheel notch */
+#define SYN_SCROLL_UNITS		4
+
 /* amount to fuzz position data when touchpad reports reduced filtering */
 #define SYN_REDUCED_FILTER_FUZZ		8
 
@@ -180,6 +183,7 @@ struct synaptics_data {
 	 */
 	struct synaptics_hw_state agm;
 	bool agm_pending;			/* new AGM packet received */
+	unsigned long agm_orphaned;		/* AGM packets not paired with SGM */
 
 	/* ForcePad handling */
 	unsigned long				press_start;
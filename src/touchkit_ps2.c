@@ -26,6 +26,7 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/slab.h>
 
 #include <linux/input.h>
 #include <linux/serio.h>
@@ -50,27 +51,148 @@
 #define TOUCHKIT_GET_X(packet)		(((packet)[1] << 7) | (packet)[2])
 #define TOUCHKIT_GET_Y(packet)		(((packet)[3] << 7) | (packet)[4])
 
+#define TOUCHKIT_MAX_SMOOTHING		7
+
+struct touchkit_ps2_data {
+	unsigned int smoothing;		/* jitter filter strength, 0 is off */
+	int x, y;			/* filtered position, 24.8 fixed point */
+	int last_x, last_y;		/* last reported position */
+	int last_touched;		/* last reported touch state, -1 if none */
+};
+
+/*
+ * Report packets have the sync bit set in the header byte only, the
+ * coordinate bytes carry 7 bits each.
+ */
+static const struct psmouse_byte_check touchkit_ps2_checks[] = {
+	PSMOUSE_CHECK(0, 0x80, 0x80),
+	PSMOUSE_CHECK(1, 0x80, 0x00),
+	PSMOUSE_CHECK(2, 0x80, 0x00),
+	PSMOUSE_CHECK(3, 0x80, 0x00),
+	PSMOUSE_CHECK(4, 0x80, 0x00),
+};
+
+static void touchkit_ps2_reset_state(struct touchkit_ps2_data *priv)
+{
+	priv->last_x = priv->last_y = -1;
+	priv->last_touched = -1;
+}
+
 static psmouse_ret_t touchkit_ps2_process_byte(struct psmouse *psmouse)
 {
+	struct touchkit_ps2_data *priv = psmouse->private;
 	unsigned char *packet = psmouse->packet;
 	struct input_dev *dev = psmouse->dev;
+	int touched, x, y;
+
+	if (!psmouse_check_byte(touchkit_ps2_checks,
+				ARRAY_SIZE(touchkit_ps2_checks),
+				packet, psmouse->pktcnt - 1))
+		return PSMOUSE_BAD_DATA;
 
 	if (psmouse->pktcnt != 5)
 		return PSMOUSE_GOOD_DATA;
 
-	input_report_abs(dev, ABS_X, TOUCHKIT_GET_X(packet));
-	input_report_abs(dev, ABS_Y, TOUCHKIT_GET_Y(packet));
-	input_report_key(dev, BTN_TOUCH, TOUCHKIT_GET_TOUCHED(packet));
+	touched = TOUCHKIT_GET_TOUCHED(packet);
+	x = TOUCHKIT_GET_X(packet) << 8;
+	y = TOUCHKIT_GET_Y(packet) << 8;
+
+	/*
+	 * Exponential smoothing while the finger stays down: each sample
+	 * moves the position by 1/2^smoothing of its distance to it. The
+	 * release keeps the filtered position, since that is where a tap
+	 * lands; a new touch starts from the raw position.
+	 */
+	if (priv->smoothing && priv->last_touched == 1) {
+		if (touched) {
+			priv->x += (x - priv->x) >> priv->smoothing;
+			priv->y += (y - priv->y) >> priv->smoothing;
+		}
+	} else {
+		priv->x = x;
+		priv->y = y;
+	}
+
+	x = (priv->x + 0x80) >> 8;
+	y = (priv->y + 0x80) >> 8;
+
+	/* Stationary touches repeat the same packet at the full sample rate */
+	if (x == priv->last_x && y == priv->last_y &&
+	    touched == priv->last_touched)
+		return PSMOUSE_FULL_PACKET;
+
+	priv->last_x = x;
+	priv->last_y = y;
+	priv->last_touched = touched;
+
+	input_report_abs(dev, ABS_X, x);
+	input_report_abs(dev, ABS_Y, y);
+	input_report_key(dev, BTN_TOUCH, touched);
 	input_sync(dev);
 
 	return PSMOUSE_FULL_PACKET;
 }
 
+static ssize_t touchkit_ps2_show_smoothing(struct psmouse *psmouse,
+					   void *data, char *buf)
+{
+	struct touchkit_ps2_data *priv = psmouse->private;
+
+	return sprintf(buf, "%u\n", priv->smoothing);
+}
+
+static ssize_t touchkit_ps2_set_smoothing(struct psmouse *psmouse, void *data,
+					  const char *buf, size_t count)
+{
+	struct touchkit_ps2_data *priv = psmouse->private;
+	unsigned int value;
+	int err;
+
+	err = kstrtouint(buf, 10, &value);
+	if (err)
+		return err;
+
+	if (value > TOUCHKIT_MAX_SMOOTHING)
+		return -EINVAL;
+
+	priv->smoothing = value;
+	touchkit_ps2_reset_state(priv);
+
+	return count;
+}
+
+PSMOUSE_DEFINE_ATTR(smoothing, S_IWUSR | S_IRUGO, NULL,
+		    touchkit_ps2_show_smoothing, touchkit_ps2_set_smoothing);
+
+static void touchkit_ps2_disconnect(struct psmouse *psmouse)
+{
+	device_remove_file(&psmouse->ps2dev.serio->dev,
+			   &psmouse_attr_smoothing.dattr);
+
+	kfree(psmouse->private);
+	psmouse->private = NULL;
+}
+
+static int touchkit_ps2_reconnect(struct psmouse *psmouse)
+{
+	struct touchkit_ps2_data *priv = psmouse->private;
+
+	if (touchkit_ps2_detect(psmouse, false))
+		return -1;
+
+	/* The input core forgets the touch state over a reset */
+	touchkit_ps2_reset_state(priv);
+
+	return 0;
+}
+
 int touchkit_ps2_detect(struct psmouse *psmouse, bool set_properties)
 {
 	struct input_dev *dev = psmouse->dev;
+	struct touchkit_ps2_data *priv;
 	unsigned char param[3];
 	int command;
+	int error;
 
 	param[0] = TOUCHKIT_CMD_LENGTH;
 	param[1] = TOUCHKIT_CMD_ACTIVE;
@@ -84,6 +206,24 @@ int touchkit_ps2_detect(struct psmouse *psmouse, bool set_properties)
 		return -ENODEV;
 
 	if (set_properties) {
+		priv = kzalloc(sizeof(struct touchkit_ps2_data), GFP_KERNEL);
+		if (!priv)
+			return -ENOMEM;
+
+		touchkit_ps2_reset_state(priv);
+		psmouse->private = priv;
+
+		error = device_create_file(&psmouse->ps2dev.serio->dev,
+					   &psmouse_attr_smoothing.dattr);
+		if (error) {
+			psmouse_err(psmouse,
+				    "failed to create smoothing sysfs attribute, error: %d\n",
+				    error);
+			kfree(priv);
+			psmouse->private = NULL;
+			return error;
+		}
+
 		dev->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_ABS);
 		dev->keybit[BIT_WORD(BTN_MOUSE)] = 0;
 		dev->keybit[BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH);
@@ -93,6 +233,8 @@ int touchkit_ps2_detect(struct psmouse *psmouse, bool set_properties)
 		psmouse->vendor = "eGalax";
 		psmouse->name = "Touchscreen";
 		psmouse->protocol_handler = touchkit_ps2_process_byte;
+		psmouse->disconnect = touchkit_ps2_disconnect;
+		psmouse->reconnect = touchkit_ps2_reconnect;
 		psmouse->pktsize = 5;
 	}
 
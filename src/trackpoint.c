@@ -9,7 +9,10 @@
  */
 
 #include <linux/slab.h>
+#include <linux/bitmap.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/string.h>
 #include <linux/serio.h>
 #include <linux/module.h>
 #include <linux/input.h>
@@ -87,23 +90,11 @@ static int trackpoint_toggle_bit(struct ps2dev *ps2dev,
 	return 0;
 }
 
-static int trackpoint_update_bit(struct ps2dev *ps2dev, unsigned char loc,
-				 unsigned char mask, unsigned char value)
-{
-	int retval = 0;
-	unsigned char data;
-
-	trackpoint_read(ps2dev, loc, &data);
-	if (((data & mask) == mask) != !!value)
-		retval = trackpoint_toggle_bit(ps2dev, loc, mask);
-
-	return retval;
-}
-
 /*
  * Trackpoint-specific attributes
  */
 struct trackpoint_attr_data {
+	const char *name;
 	size_t field_offset;
 	unsigned char command;
 	unsigned char mask;
@@ -144,6 +135,7 @@ static ssize_t trackpoint_set_int_attr(struct psmouse *psmouse, void *data,
 
 #define TRACKPOINT_INT_ATTR(_name, _command, _default)				\
 	static struct trackpoint_attr_data trackpoint_attr_##_name = {		\
+		.name = __stringify(_name),					\
 		.field_offset = offsetof(struct trackpoint_data, _name),	\
 		.command = _command,						\
 		.power_on_default = _default,					\
@@ -182,6 +174,7 @@ static ssize_t trackpoint_set_bit_attr(struct psmouse *psmouse, void *data,
 
 #define TRACKPOINT_BIT_ATTR(_name, _command, _mask, _inv, _default)	\
 static struct trackpoint_attr_data trackpoint_attr_##_name = {		\
+	.name			= __stringify(_name),			\
 	.field_offset		= offsetof(struct trackpoint_data,	\
 					   _name),			\
 	.command		= _command,				\
@@ -193,27 +186,6 @@ PSMOUSE_DEFINE_ATTR(_name, S_IWUSR | S_IRUGO,				\
 		    &trackpoint_attr_##_name,				\
 		    trackpoint_show_int_attr, trackpoint_set_bit_attr)
 
-#define TRACKPOINT_UPDATE_BIT(_psmouse, _tp, _name)			\
-do {									\
-	struct trackpoint_attr_data *_attr = &trackpoint_attr_##_name;	\
-									\
-	trackpoint_update_bit(&_psmouse->ps2dev,			\
-			_attr->command, _attr->mask, _tp->_name);	\
-} while (0)
-
-#define TRACKPOINT_UPDATE(_power_on, _psmouse, _tp, _name)		\
-do {									\
-	if (!_power_on ||						\
-	    _tp->_name != trackpoint_attr_##_name.power_on_default) {	\
-		if (!trackpoint_attr_##_name.mask)			\
-			trackpoint_write(&_psmouse->ps2dev,		\
-				 trackpoint_attr_##_name.command,	\
-				 _tp->_name);				\
-		else							\
-			TRACKPOINT_UPDATE_BIT(_psmouse, _tp, _name);	\
-	}								\
-} while (0)
-
 #define TRACKPOINT_SET_POWER_ON_DEFAULT(_tp, _name)				\
 	(_tp->_name = trackpoint_attr_##_name.power_on_default)
 
@@ -235,6 +207,187 @@ TRACKPOINT_BIT_ATTR(skipback, TP_TOGGLE_SKIPBACK, TP_MASK_SKIPBACK, 0,
 TRACKPOINT_BIT_ATTR(ext_dev, TP_TOGGLE_EXT_DEV, TP_MASK_EXT_DEV, 1,
 		    TP_DEF_EXT_DEV);
 
+/*
+ * Parameters kept in trackpoint_data, in the order trackpoint_sync()
+ * writes them to the device.
+ */
+static const struct trackpoint_attr_data *trackpoint_params[] = {
+	&trackpoint_attr_sensitivity,
+	&trackpoint_attr_inertia,
+	&trackpoint_attr_speed,
+	&trackpoint_attr_reach,
+	&trackpoint_attr_draghys,
+	&trackpoint_attr_mindrag,
+	&trackpoint_attr_thresh,
+	&trackpoint_attr_upthresh,
+	&trackpoint_attr_ztime,
+	&trackpoint_attr_jenks,
+
+	/* toggles */
+	&trackpoint_attr_press_to_select,
+	&trackpoint_attr_skipback,
+	&trackpoint_attr_ext_dev,
+};
+
+/*
+ * Features that may make device unusable with this driver; they are
+ * forced to their power-on values whenever the TP is in an unknown state.
+ */
+static const struct trackpoint_attr_data trackpoint_fixed_bits[] = {
+	{
+		.command		= TP_TOGGLE_TWOHAND,
+		.mask			= TP_MASK_TWOHAND,
+		.power_on_default	= TP_DEF_TWOHAND,
+	},
+	{
+		.command		= TP_TOGGLE_SOURCE_TAG,
+		.mask			= TP_MASK_SOURCE_TAG,
+		.power_on_default	= TP_DEF_SOURCE_TAG,
+	},
+	{
+		.command		= TP_TOGGLE_MB,
+		.mask			= TP_MASK_MB,
+		.power_on_default	= TP_DEF_MB,
+	},
+};
+
+/*
+ * The profile attribute sets several parameters at once: it takes
+ * whitespace separated name=value pairs using the names and the values
+ * of the individual attributes, validates all of them and then writes
+ * the ones that changed while the device is deactivated only once.
+ */
+static ssize_t trackpoint_show_profile(struct psmouse *psmouse, void *data,
+				       char *buf)
+{
+	struct trackpoint_data *tp = psmouse->private;
+	const struct trackpoint_attr_data *attr;
+	unsigned char value;
+	int i, len = 0;
+
+	for (i = 0; i < ARRAY_SIZE(trackpoint_params); i++) {
+		attr = trackpoint_params[i];
+		value = *(unsigned char *)((char *)tp + attr->field_offset);
+		if (attr->inverted)
+			value = !value;
+
+		len += sprintf(buf + len, "%s%s=%u", i ? " " : "",
+			       attr->name, value);
+	}
+
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static ssize_t trackpoint_set_profile(struct psmouse *psmouse, void *data,
+				      const char *buf, size_t count)
+{
+	struct trackpoint_data *tp = psmouse->private;
+	struct trackpoint_data new = *tp;
+	const struct trackpoint_attr_data *attr;
+	unsigned char *field, *new_field;
+	unsigned int writes = 0, failed = 0;
+	char *str, *p, *tok, *val;
+	unsigned char value;
+	ktime_t start;
+	int i, err = 0;
+
+	str = kstrndup(buf, count, GFP_KERNEL);
+	if (!str)
+		return -ENOMEM;
+
+	p = str;
+	while ((tok = strsep(&p, " \t\n")) != NULL) {
+		if (!*tok)
+			continue;
+
+		val = strchr(tok, '=');
+		if (!val) {
+			err = -EINVAL;
+			break;
+		}
+		*val++ = '\0';
+
+		for (i = 0; i < ARRAY_SIZE(trackpoint_params); i++)
+			if (!strcmp(tok, trackpoint_params[i]->name))
+				break;
+
+		if (i == ARRAY_SIZE(trackpoint_params)) {
+			err = -EINVAL;
+			break;
+		}
+
+		attr = trackpoint_params[i];
+
+		err = kstrtou8(val, 10, &value);
+		if (err)
+			break;
+
+		if (attr->mask) {
+			if (value > 1) {
+				err = -EINVAL;
+				break;
+			}
+
+			if (attr->inverted)
+				value = !value;
+		}
+
+		*((unsigned char *)&new + attr->field_offset) = value;
+	}
+
+	kfree(str);
+	if (err)
+		return err;
+
+	start = ktime_get();
+
+	for (i = 0; i < ARRAY_SIZE(trackpoint_params); i++) {
+		attr = trackpoint_params[i];
+		field = (unsigned char *)tp + attr->field_offset;
+		new_field = (unsigned char *)&new + attr->field_offset;
+
+		if (*field == *new_field)
+			continue;
+
+		if (attr->mask)
+			err = trackpoint_toggle_bit(&psmouse->ps2dev,
+						    attr->command, attr->mask);
+		else
+			err = trackpoint_write(&psmouse->ps2dev,
+					       attr->command, *new_field);
+		if (err) {
+			failed++;
+			continue;
+		}
+
+		*field = *new_field;
+		writes++;
+	}
+
+	tp->profile_writes = writes;
+	tp->profile_usecs = ktime_us_delta(ktime_get(), start);
+
+	psmouse_dbg(psmouse, "profile applied: %u writes, %u failed, %uus\n",
+		    writes, failed, tp->profile_usecs);
+
+	return failed ? -EIO : count;
+}
+
+PSMOUSE_DEFINE_ATTR(profile, S_IWUSR | S_IRUGO, NULL,
+		    trackpoint_show_profile, trackpoint_set_profile);
+
+static ssize_t trackpoint_show_profile_cost(struct psmouse *psmouse,
+					    void *data, char *buf)
+{
+	struct trackpoint_data *tp = psmouse->private;
+
+	return sprintf(buf, "%u %u\n", tp->profile_writes, tp->profile_usecs);
+}
+
+PSMOUSE_DEFINE_RO_ATTR(profile_cost, S_IRUGO, NULL,
+		       trackpoint_show_profile_cost);
+
 static struct attribute *trackpoint_attrs[] = {
 	&psmouse_attr_sensitivity.dattr.attr,
 	&psmouse_attr_speed.dattr.attr,
@@ -249,6 +402,8 @@ static struct attribute *trackpoint_attrs[] = {
 	&psmouse_attr_press_to_select.dattr.attr,
 	&psmouse_attr_skipback.dattr.attr,
 	&psmouse_attr_ext_dev.dattr.attr,
+	&psmouse_attr_profile.dattr.attr,
+	&psmouse_attr_profile_cost.dattr.attr,
 	NULL
 };
 
@@ -272,29 +427,99 @@ static int trackpoint_start_protocol(struct psmouse *psmouse, unsigned char *fir
 	return 0;
 }
 
+/*
+ * Copy of the RAM locations read back during a sync, so that locations
+ * holding several toggles are only read once and bits toggled along the
+ * way stay accurate.
+ */
+struct trackpoint_ram {
+	DECLARE_BITMAP(valid, TP_RAM_SIZE);
+	unsigned char data[TP_RAM_SIZE];
+};
+
+static int trackpoint_ram_read(struct ps2dev *ps2dev, struct trackpoint_ram *ram,
+			       unsigned char loc, unsigned char *value)
+{
+	if (loc >= TP_RAM_SIZE)
+		return -1;
+
+	if (!test_bit(loc, ram->valid)) {
+		if (trackpoint_read(ps2dev, loc, &ram->data[loc]))
+			return -1;
+		__set_bit(loc, ram->valid);
+	}
+
+	*value = ram->data[loc];
+	return 0;
+}
+
+/*
+ * Bring a single parameter to the wanted value, touching the device only
+ * if it differs from what is read back. When readback is false the
+ * current value of a RAM location is known to differ and it is written
+ * blindly; toggles are always read since a toggle needs the current state.
+ * Returns 1 if the device was written, 0 if it already matched and
+ * negative on failure.
+ */
+static int trackpoint_sync_param(struct ps2dev *ps2dev, struct trackpoint_ram *ram,
+				 const struct trackpoint_attr_data *attr,
+				 unsigned char value, bool readback)
+{
+	unsigned char cur;
+
+	if (!attr->mask) {
+		if (readback &&
+		    !trackpoint_ram_read(ps2dev, ram, attr->command, &cur) &&
+		    cur == value)
+			return 0;
+
+		return trackpoint_write(ps2dev, attr->command, value) ? -1 : 1;
+	}
+
+	if (trackpoint_ram_read(ps2dev, ram, attr->command, &cur))
+		return -1;
+
+	if (((cur & attr->mask) == attr->mask) == !!value)
+		return 0;
+
+	if (trackpoint_toggle_bit(ps2dev, attr->command, attr->mask))
+		return -1;
+
+	ram->data[attr->command] ^= attr->mask;
+	return 1;
+}
+
 /*
  * Write parameters to trackpad.
  * in_power_on_state: Set to true if TP is in default / power-on state (ex. if
  *		      power-on reset was run). If so, values will only be
  *		      written to TP if they differ from power-on default.
+ *		      Otherwise current values are read back and only the
+ *		      ones differing from trackpoint_data are written.
  */
 static int trackpoint_sync(struct psmouse *psmouse, bool in_power_on_state)
 {
+	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	struct trackpoint_data *tp = psmouse->private;
+	const struct trackpoint_attr_data *attr;
+	struct trackpoint_ram ram;
+	unsigned char value;
+	int written = 0, failed = 0;
+	int i, ret;
+
+	bitmap_zero(ram.valid, TP_RAM_SIZE);
 
 	if (!in_power_on_state) {
-		/*
-		 * Disable features that may make device unusable
-		 * with this driver.
-		 */
-		trackpoint_update_bit(&psmouse->ps2dev, TP_TOGGLE_TWOHAND,
-				      TP_MASK_TWOHAND, TP_DEF_TWOHAND);
-
-		trackpoint_update_bit(&psmouse->ps2dev, TP_TOGGLE_SOURCE_TAG,
-				      TP_MASK_SOURCE_TAG, TP_DEF_SOURCE_TAG);
-
-		trackpoint_update_bit(&psmouse->ps2dev, TP_TOGGLE_MB,
-				      TP_MASK_MB, TP_DEF_MB);
+		for (i = 0; i < ARRAY_SIZE(trackpoint_fixed_bits); i++) {
+			attr = &trackpoint_fixed_bits[i];
+			ret = trackpoint_sync_param(ps2dev, &ram, attr,
+						    attr->power_on_default,
+						    true);
+			if (ret < 0)
+				failed++;
+			else
+				written += ret;
+		}
 	}
 
 	/*
@@ -302,21 +527,23 @@ static int trackpoint_sync(struct psmouse *psmouse, bool in_power_on_state)
 	 * configure them if the values are non-default or if the TP is in
 	 * an unknown state.
 	 */
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, sensitivity);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, inertia);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, speed);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, reach);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, draghys);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, mindrag);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, thresh);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, upthresh);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, ztime);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, jenks);
+	for (i = 0; i < ARRAY_SIZE(trackpoint_params); i++) {
+		attr = trackpoint_params[i];
+		value = *(unsigned char *)((char *)tp + attr->field_offset);
+
+		if (in_power_on_state && value == attr->power_on_default)
+			continue;
+
+		ret = trackpoint_sync_param(ps2dev, &ram, attr, value,
+					    !in_power_on_state);
+		if (ret < 0)
+			failed++;
+		else
+			written += ret;
+	}
 
-	/* toggles */
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, press_to_select);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, skipback);
-	TRACKPOINT_UPDATE(in_power_on_state, psmouse, tp, ext_dev);
+	psmouse_dbg(psmouse, "synced parameters: %d written, %d failed\n",
+		    written, failed);
 
 	return 0;
 }
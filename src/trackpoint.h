@@ -71,6 +71,8 @@
 #define TP_Z_TIME		0x5E	/* How sharp of a press */
 #define TP_JENKS_CURV		0x5D	/* Minimum curvature for double click */
 
+#define TP_RAM_SIZE		0x80	/* Locations above hold no properties */
+
 /*
  * Toggling Flag bits
  */
@@ -142,6 +144,10 @@ struct trackpoint_data
 	unsigned char press_to_select;
 	unsigned char skipback;
 	unsigned char ext_dev;
+
+	/* last write to the profile attribute */
+	unsigned int profile_writes;
+	unsigned int profile_usecs;
 };
 
 #ifdef CONFIG_MOUSE_PS2_TRACKPOINT